@@ -1,24 +1,28 @@
 #include "QuantumMinigolf.h"
 
-#include <plugin/bz2/bz2.h>
-#include <plugin/png/png.h>
-#include "imgs/imgs.brc"
-
-MinigolfDrawer::MinigolfDrawer() :
-	simulator(WIDTH, HEIGHT, 0.0001) {
+MinigolfDrawer::MinigolfDrawer() {
+	dt = GAME_DT;
+	integrator = INTEGRATOR_LIE;
+	simulator = new QuantumSimulator(FIELD_WIDTH, FIELD_HEIGHT, dt, CPU_Cores());
+	measure_rule = MEASURE_CLASSIC;
+	simulator->SetMeasurementRule(measure_rule);
 	state = STATE_AIMING;
 	hack_state = HACKSTATE_NULL;
 	track = NULL;
+	measure = 0;
+	observe = 0;
+	shots = 0;
+	recording = -1;
+	frame_rate = 50;
+	steps_per_frame = 2;
+	sim_rate = 0;
+	profile_overlay = false;
 	
-	MemReadStream cmap_mem(cmap_brc, cmap_brc_length);
-	cmap = PNGRaster().LoadString(BZ2Decompress(cmap_mem));
-	
-	MemReadStream cmap_mono_mem(cmap_mono_brc, cmap_mono_brc_length);
-	cmap_mono = PNGRaster().LoadString(BZ2Decompress(cmap_mono_mem));
+	WantFocus();
 	
 	Start();
 	
-	PostCallback(THISBACK(Refresher));
+	SetFrameRate(frame_rate);
 }
 
 MinigolfDrawer::~MinigolfDrawer() {
@@ -33,22 +37,56 @@ void MinigolfDrawer::Start() {
 
 void MinigolfDrawer::Stop() {
 	running = false;
-	while (!stopped) Sleep(100);
+	while (!stopped) Sleep(1);
 }
 
+// repaints are driven by a periodic timer, independent of the simulation thread
 void MinigolfDrawer::Refresher() {
 	Refresh();
-	
-	PostCallback(THISBACK(Refresher));
+}
+
+void MinigolfDrawer::SetFrameRate(int fps) {
+	frame_rate = max(fps, 1);
+	KillTimeCallback();
+	SetTimeCallback(-1000 / frame_rate, THISBACK(Refresher));
+}
+
+void MinigolfDrawer::SetStepsPerFrame(int n) {
+	steps_per_frame = max(n, 1);
+	sim_rate = 0;
+}
+
+void MinigolfDrawer::SetSimRate(double rate) {
+	sim_rate = rate;
+}
+
+// StepsDue - the number of split steps that should have been done after
+// the given wall-clock time, either a fixed number per displayed frame or
+// as many as keep simulated time / wall-clock time at sim_rate. The steps per
+// frame are counted in GAME_DT, so a larger timestep does not speed up the ball.
+int64 MinigolfDrawer::StepsDue(int64 elapsed_us) const {
+	if (sim_rate > 0)
+		return (int64)(sim_rate * elapsed_us / 1e6 / simulator->GetDt());
+	return (int64)((double)steps_per_frame * frame_rate * elapsed_us / 1e6 * GAME_DT / simulator->GetDt());
 }
 
 void MinigolfDrawer::Run() {
-	double normlast = 1;
-	double nsq = WIDTH * HEIGHT;
 	double vmax = 40; // maximum club speed
 	double v = 0;
+	int64 moving_start = 0; // time when the ball was hit
+	int64 steps_done = 0;
+	
+	SetProfileThreadName("simulation");
 	
 	while (running && !Thread::IsShutdownThreads()) {
+		if ((bool)observe != simulator->IsObserving())
+			simulator->SetObservables(observe);
+		// the writer finishes the file on its own
+		if (recording >= 0 && state != STATE_MOVING) {
+			recorder[recording].Finish();
+			recording = -1;
+		}
+		
 		if (state == STATE_AIMING) {
 			
 		}
@@ -88,56 +126,76 @@ void MinigolfDrawer::Run() {
 			
 			// commented out for uncertainty movie 070519
 			if (hack_state != HACKSTATE_MOVIE) {
-				simulator.GenGauss(ballx, bally,
-								   -2 * v  *M_PI / 2 * cos(racket_rphi) / 2,
-								   -2 * v * M_PI / 2 * sin(racket_rphi) / 2,
-								   10);
+				Shot shot;
+				shot.ballx = ballx;
+				shot.bally = bally;
+				shot.phi = racket_rphi;
+				shot.v = v;
+				shot.Fire(*simulator);
 			} else {
 				// hack for uncertainty movie 070519
-				simulator.GenGauss( 200, bally,
-					-.4,
-					0,
-					15);
-				simulator.GenGauss( 400, bally,
-					-.4,
-					0,
-					6);
-				simulator.GenGauss( 600, bally,
-					-.4,
-					0,
-					3);
+				FireUncertainty(*simulator, bally);
+			}
+			
+			moving_start = usecs();
+			steps_done = 0;
+			measure = 0;
+			
+			// a recorder whose writer is done; the shot is not recorded if
+			// both are still busy, as opening one would wait for it
+			int r = recorder[0].IsWriting() ? 1 : 0;
+			if (record_dir.GetCount() && !recorder[r].IsWriting()) {
+				RealizeDirectory(record_dir);
+				if (recorder[r].Open(AppendFileName(record_dir, Format("shot%03d.qrec", ++shots)),
+				                     simulator->GetWidth(), simulator->GetHeight(), simulator->GetDt()))
+					recording = r;
 			}
 			
+			simulator->Snapshot(snapshot.Back());
+			if (recording >= 0)
+				recorder[recording].Add(snapshot.Back());
+			snapshot.Publish();
+			
 			continue;
 		}
 		
 		else if (state == STATE_MOVING) {
+			// the measurement is done here, as only this thread touches psi
+			if (measure) {
+				StopMoving();
+				state = STATE_FINISHED;
+				continue;
+			}
 			
-			lock.Enter();
+			int64 due = StepsDue(usecs() - moving_start);
 			
-			if (hack_state != HACKSTATE_SATURATED_FULL) {
-				
-				// propagate in momentum space
-				simulator.PropagateMomentum();
-				
-				// propagate in position space
-				double d = 1 / nsq / sqrt(normlast);
-				normlast = simulator.PropagatePosition(d);
-				ASSERT(IsFin(normlast));
-				
-			} else {
-				
-				// propagate in position space
-				double d = 1 / nsq / sqrt(normlast);
-				normlast = simulator.PropagatePosition(d);
-				ASSERT(IsFin(normlast));
-				
-				// propagate in momentum space
-				simulator.PropagateMomentum();
-				
+			// ahead of schedule: wait for the clock instead of a fixed sleep
+			if (steps_done >= due) {
+				PROFILE_SCOPE("wait for the clock");
+				Sleep(1);
+				continue;
+			}
+			
+			// when the CPU cannot keep up, slow down instead of piling up
+			// a backlog that would be worked off in a burst later
+			int64 backlog = StepsDue(250000);
+			if (due - steps_done > backlog)
+				steps_done = due - backlog;
+			
+			// the saturated hack comes from propagating in position space first
+			simulator->Step(IsMoviePositionFirst(GetStyle()));
+			
+			// hand a copy of psi to Paint once it has taken the previous one
+			if (!snapshot.IsFresh()) {
+				PROFILE_SCOPE("publish");
+				simulator->Snapshot(snapshot.Back());
+				if (recording >= 0)
+					recorder[recording].Add(snapshot.Back());
+				snapshot.Publish();
 			}
 			
-			lock.Leave();
+			steps_done++;
+			continue;
 		}
 		else if (state == STATE_FINISHED) {
 			
@@ -149,50 +207,97 @@ void MinigolfDrawer::Run() {
 	stopped = true;
 }
 
+// ResetBall - the ball back at the tee of the track, no wave on it
+void MinigolfDrawer::ResetBall() {
+	ballx = track->ball.x;
+	bally = track->ball.y;
+	ballr = 5;
+	racket_r = 20;
+	racket_l = 15;
+	racket_rphi = 0;
+	
+	simulator->Clear();
+}
+
 void MinigolfDrawer::SetTrack(Track& track) {
 	Stop();
 	
 	state = STATE_AIMING;
 	
 	this->track = &track;
+	hole = track.hole;
+	ResetBall();
+	simulator->SetObservedHole(hole);
 	
-	ballx = 550;
-	bally = 160;
-	ballr = 5;
-	holex = 100;
-	holey = 160;
-	holer = 30;
-	racket_r = 20;
-	racket_l = 15;
-	racket_rphi = 0;
+	// the track or the hole may have changed
+	background.Clear();
 	
-	simulator.Clear();
+	// the momentum propagator does not depend on the track, the position
+	// propagator of each track is built once per grid and timestep
+	simulator->SetPropagator(propagators.Get(track.potential, simulator->GetSize(), dt, integrator));
 	
-	simulator.BuildMomentumPropagator();
+	Start();
+}
+
+// Restart - play the track again with the propagator as it is. The wave is
+// cleared while the simulation thread is stopped, as it may still be stepping.
+void MinigolfDrawer::Restart() {
+	Stop();
 	
-	// for each new track, the position propagator must be rebuilt
-	simulator.BuildPositionPropagator(track.base);
+	state = STATE_AIMING;
+	ResetBall();
 	
 	Start();
 }
 
-void MinigolfDrawer::StopMoving() {
-	lock.Enter();
+// SetGrid - simulate on a grid of sz cells, e.g. 320x160 for slow machines.
+// The game itself keeps working in field coordinates.
+void MinigolfDrawer::SetGrid(Size sz) {
+	Stop();
+	
+	state = STATE_AIMING;
+	
+	simulator = new QuantumSimulator(sz.cx, sz.cy, dt, CPU_Cores());
+	simulator->SetIntegrator(integrator);
+	simulator->SetMeasurementRule(measure_rule);
+	simulator->SetObservedHole(hole);
+	background.Clear();
+	
+	if (track)
+		simulator->SetPropagator(propagators.Get(track->potential, sz, dt, integrator));
 	
-	// Collapse position
-	simulator.PositionMeasurement(&ballx, &bally);
-	if ((ballx - holex)*(ballx - holex) + (bally - holey)*(bally - holey) < holer*holer)
+	Start();
+}
+
+// SetIntegrator - step with another splitting and timestep, e.g. Strang at
+// 0.0004 for a quarter of the FFTs, see QuantumMinigolfCli -accuracy
+void MinigolfDrawer::SetIntegrator(int integrator, double dt) {
+	this->integrator = integrator;
+	this->dt = dt;
+	SetGrid(simulator->GetSize());
+}
+
+void MinigolfDrawer::SetMeasurementRule(int rule) {
+	measure_rule = rule;
+	simulator->SetMeasurementRule(rule);
+}
+
+void MinigolfDrawer::StopMoving() {
+	// Collapse position, from grid to field coordinates
+	int x, y;
+	simulator->PositionMeasurement(&x, &y);
+	ballx = x * FIELD_WIDTH / simulator->GetWidth();
+	bally = y * FIELD_HEIGHT / simulator->GetHeight();
+	if (hole.Contains(ballx, bally))
 		res = QMG_WIN;
 	else
 		res = QMG_LOSE;
-	
-	lock.Leave();
 }
 
 void MinigolfDrawer::MouseMove(Point p, dword keyflags) {
 	if (state == STATE_AIMING) {
-		int xoff = (GetSize().cx - WIDTH) / 2;
-		int yoff = (GetSize().cy - HEIGHT) / 2;
+		int xoff = (GetSize().cx - FIELD_WIDTH) / 2;
+		int yoff = (GetSize().cy - FIELD_HEIGHT) / 2;
 		double dx = p.x - ballx - xoff;
 		double dy = p.y - bally - yoff;
 		
@@ -213,12 +318,11 @@ void MinigolfDrawer::LeftDown(Point p, dword keyflags) {
 		state = STATE_SETVELOCITY;
 	}
 	else if (state == STATE_MOVING) {
-		state = STATE_FINISHED;
-		StopMoving();
+		// Run() measures and finishes at its next step
+		measure = 1;
 	}
 	else if (state == STATE_FINISHED) {
-		state = STATE_AIMING;
-		SetTrack(*track);
+		Restart();
 	}
 }
 
@@ -228,32 +332,103 @@ void MinigolfDrawer::LeftUp(Point p, dword keyflags) {
 	}
 }
 
+// GetStyle - the look of the wave in the hack state, shared with the movies of
+// QuantumMinigolfMovie
+int MinigolfDrawer::GetStyle() const {
+	switch (hack_state) {
+	case HACKSTATE_COLOR:             return MOVIE_COLOR;
+	case HACKSTATE_SATURATED_PARTIAL: return MOVIE_SATURATED;
+	case HACKSTATE_SATURATED_FULL:    return MOVIE_INVERTED;
+	case HACKSTATE_MOVIE:             return MOVIE_UNCERTAINTY;
+	}
+	return MOVIE_PLAIN;
+}
+
 void MinigolfDrawer::Paint(Draw& w) {
+	{
+		PROFILE_SCOPE("Paint");
+		PaintField(w);
+	}
+	if (profile_overlay)
+		PaintProfile(w);
+}
+
+void MinigolfDrawer::PaintField(Draw& w) {
 	Size sz = GetSize();
 	
-	if (!track) {w.DrawRect(sz, Black()); return;}
+	w.DrawRect(sz, Black());
 	
-	int width	= track->base.GetWidth();
-	int height	= track->base.GetHeight();
+	if (!track) return;
 	
+	int width	= FIELD_WIDTH;
+	int height	= FIELD_HEIGHT;
+	int xoff	= (sz.cx - width) / 2;
+	int yoff	= (sz.cy - height) / 2;
 	
-	ImageDraw id(width, height);
-	id.DrawRect(0,0,width,height, White());
-	
+	// Render wave
+	if (state == STATE_MOVING) {
+		Size grid = simulator->GetSize();
+		if (background.GetSize() != grid) {
+			PROFILE_SCOPE("background");
+			background = RenderTrackBackground(*track, grid);
+		}
+		
+		const Image& cmap = GetMovieColormap(GetStyle());
+		int mode = GetMovieWaveMode(GetStyle());
+		
+		// takes over the pixels of the previous paint, unless they are still in use
+		ImageBuffer ib(wave);
+		if (ib.GetSize() != grid)
+			ib.Create(grid);
+		
+		// the latest copy of psi published by Run(), never waits for a step
+		const PsiFrame *frame;
+		{
+			PROFILE_SCOPE("read psi");
+			frame = &snapshot.Read();
+		}
+		{
+			PROFILE_SCOPE("colormap");
+			if (frame->width == grid.cx && frame->height == grid.cy)
+				RenderWave(ib.Begin(), background.Begin(), *frame, cmap, mode);
+			else
+				memcpy(ib.Begin(), background.Begin(), grid.cx * grid.cy * sizeof(RGBA));
+		}
+		
+		{
+			PROFILE_SCOPE("blit");
+			wave = ib;
+			w.DrawImage(xoff, yoff, width, height, wave);
+		}
+		
+		// Paint is the only reader of the ring of the simulator
+		if (observe && simulator->IsObserving()) {
+			Observables o;
+			while (simulator->GetObservableRing().Get(o))
+				observed = o;
+			String txt = Format("t %.4f   p(hole) %.1f%%   <x> %.0f   <y> %.0f   spread %.0f x %.0f   E %.0f",
+			                    observed.step * simulator->GetDt(), 100 * observed.hole,
+			                    observed.x, observed.y, observed.sx, observed.sy, observed.GetEnergy());
+			Font fnt = Monospace(11);
+			w.DrawText(xoff + 4, yoff + height - fnt.GetLineHeight() - 2, txt, fnt, White());
+		}
+		return;
+	}
 	
+	w.Clipoff(xoff, yoff, width, height);
+	w.DrawRect(0,0,width,height, White());
 	
 	// Render Track
-	id.DrawImage(0, 0, track->base);
+	{
+		PROFILE_SCOPE("blit");
+		w.DrawImage(0, 0, width, height, track->potential);
+	}
 	
+	// Render hole
+	w.DrawEllipse(hole.x - hole.r, hole.y - hole.r, hole.r*2, hole.r*2, Black(), 2, Color(0, 0, 255));
 	
-	// Render Ball
-	if (state != STATE_MOVING) {
-		// Render hole
-		id.DrawEllipse(holex - holer, holey - holer, holer*2, holer*2, Black(), 2, Color(0, 0, 255));
-		
-		// Render ball
-		id.DrawEllipse(ballx - ballr, bally - ballr, ballr*2, ballr*2, Color(255, 255, 0));
-	}
+	// Render ball
+	w.DrawEllipse(ballx - ballr, bally - ballr, ballr*2, ballr*2, Color(255, 255, 0));
 	
 	// Render Racket
 	if (state < STATE_MOVING) {
@@ -264,78 +439,9 @@ void MinigolfDrawer::Paint(Draw& w) {
 		yo = bally + racket_r * sin(racket_rphi) + .5 * racket_l * cos(racket_rphi);
 		yl = bally + racket_r * sin(racket_rphi) - .5 * racket_l * cos(racket_rphi);
 		
-		id.DrawLine(xo, yo, xl, yl, 1, White());
+		w.DrawLine(xo, yo, xl, yl, 1, White());
 	}
 	
-	
-	// Render wave
-	if (state == STATE_MOVING) {
-		
-		// Render hole
-		id.DrawEllipse(holex - holer, holey - holer, holer*2, holer*2, Black(), 2, Color(0, 0, 255));
-		
-		Image& cmap = hack_state != HACKSTATE_NULL? this->cmap : this->cmap_mono;
-		int cw = cmap.GetWidth();
-		int ch = cmap.GetHeight();
-		uint8 red, dummy;
-		
-		//ImageBuffer wave(width, height);
-		ImageBuffer wave(id);
-		
-		const RGBA* cmap_dat = cmap.Begin();
-		RGBA* wave_dat = wave.Begin();
-		
-		lock.Enter();
-		
-		for (int y = 0; y < height; y++) {
-			for (int x = 0; x < width; x++) {
-			
-				int cx = (int)(simulator.psi[x*height + y][1]) + 128;
-				int cy = (int)(simulator.psi[x*height + y][0]) + 128;
-				
-				if (cx > 240)
-					cx = 240;
-					
-				if (cx < 0)
-					cx = 0;
-					
-				if (cy > 240)
-					cy = 240;
-					
-				if (cy < 0)
-					cy = 0;
-				
-				const RGBA* src = (cmap_dat + cy*cw + cx);
-				
-				if (hack_state == HACKSTATE_SATURATED_PARTIAL) {
-					wave_dat->r = min(255, (int)wave_dat->r + (int)src->r * 10000);
-					wave_dat->g = min(255, (int)wave_dat->g + (int)src->g * 10000);
-					wave_dat->b = min(255, (int)wave_dat->b + (int)src->b * 10000);
-				}
-				else if (hack_state == HACKSTATE_SATURATED_FULL) {
-					wave_dat->r = src->r != 0 ? 0 : 255;
-					wave_dat->g = src->g != 0 ? 0 : 255;
-					wave_dat->b = src->b != 0 ? 0 : 255;
-				} else {
-					wave_dat->r = min(255, (int)wave_dat->r + (int)src->r);
-					wave_dat->g = min(255, (int)wave_dat->g + (int)src->g);
-					wave_dat->b = min(255, (int)wave_dat->b + (int)src->b);
-				}
-				
-				wave_dat++;
-			}
-		}
-		lock.Leave();
-		
-		
-		ImageDraw bg(sz);
-		bg.DrawRect(sz, Black());
-		bg.DrawImage((sz.cx - width) / 2, (sz.cy - height) / 2, wave);
-		w.DrawImage(0,0,bg);
-		return;
-	}
-	
-	
 	// Render text
 	if (state == STATE_FINISHED) {
 		String txt;
@@ -351,13 +457,56 @@ void MinigolfDrawer::Paint(Draw& w) {
 		Font fnt = SansSerif(45);
 		Size txt_sz = GetTextSize(txt, fnt);
 		
-		id.DrawText((width - txt_sz.cx) / 2, (height - txt_sz.cy) / 2, txt, fnt, clr);
+		w.DrawText((width - txt_sz.cx) / 2, (height - txt_sz.cy) / 2, txt, fnt, clr);
 	}
 	
-	ImageDraw bg(sz);
-	bg.DrawRect(sz, Black());
-	bg.DrawImage((sz.cx - width) / 2, (sz.cy - height) / 2,id);
+	w.End();
+}
+
+// PaintProfile - p50 and p99 of the phases and their histograms from 1 us
+// (left) to 16 ms (right), in the top left corner
+void MinigolfDrawer::PaintProfile(Draw& w) const {
+	Vector<ProfileStats> stats = GetProfileStats();
+	Font fnt = Monospace(11);
+	int lh = fnt.GetLineHeight();
+	int bar = 3;
+	int cx = GetTextSize("wait for the clock  99999.9 99999.9 ", fnt).cx;
+	
+	if (stats.GetCount() == 0) {
+		String txt = IsProfileBuild() ? "No phases timed yet" : "Built without the PROFILE flag";
+		w.DrawRect(0, 0, GetTextSize(txt, fnt).cx + 8, lh + 4, Black());
+		w.DrawText(4, 2, txt, fnt, White());
+		return;
+	}
 	
+	w.DrawRect(0, 0, cx + PROFILE_BUCKETS * bar + 8, (stats.GetCount() + 1) * lh + 4, Black());
+	w.DrawText(4, 2, Format("%-18s %7s %7s us", "phase", "p50", "p99"), fnt, Gray());
 	
-	w.DrawImage(0,0,bg);
+	for (int i = 0; i < stats.GetCount(); i++) {
+		const ProfileStats& st = stats[i];
+		int y = 2 + (i + 1) * lh;
+		w.DrawText(4, y, Format("%-18.18s %7.1f %7.1f", st.name, st.p50, st.p99), fnt, White());
+		
+		int peak = 1;
+		for (int b = 0; b < PROFILE_BUCKETS; b++)
+			peak = max(peak, st.histogram[b]);
+		for (int b = 0; b < PROFILE_BUCKETS; b++) {
+			int h = (lh - 2) * st.histogram[b] / peak;
+			w.DrawRect(4 + cx + b * bar, y + lh - 1 - h, bar - 1, h, LtGreen());
+		}
+	}
+}
+
+// F2 toggles the observables, F3 the timings
+bool MinigolfDrawer::Key(dword key, int count) {
+	if (key == K_F2) {
+		observe = !observe;
+		return true;
+	}
+	if (key == K_F3) {
+		profile_overlay = !profile_overlay;
+		Refresh();
+		return true;
+	}
+	return false;
 }
@@ -1,21 +1,14 @@
 #include "QuantumMinigolf.h"
 
-#include <plugin/bz2/bz2.h>
-#include <plugin/bmp/bmp.h>
-#include "imgs/imgs.brc"
-
 inline int Area(const Size& sz) {return sz.cx * sz.cy;}
 
 void TrackImage::Paint(Draw& w, const Rect& r, const Value& q, Color ink, Color paper, dword style) const {
 	w.DrawRect(r, paper);
 	int i = q;
-	QuantumMinigolf& qm = GetQuantumMinigolf();
-	const Image& img = qm.GetTrack(i);
+	const Image& img = owner->GetThumbnail(i, r.GetHeight());
 	Size sz = img.GetSize();
 	if (sz.cx <= 0 || sz.cy <= 0) return;
-	sz /=  (double)sz.cy / r.GetHeight();
-	Image img_scaled = Rescale(img, sz);
-	w.DrawImage(r.left + r.Width() / 2 - sz.cx / 2, r.top, img_scaled);
+	w.DrawImage(r.left + r.Width() / 2 - sz.cx / 2, r.top, img);
 }
 
 
@@ -27,6 +20,7 @@ QuantumMinigolf::QuantumMinigolf() {
 	
 	tracksctrl.AddColumn("Track");
 	tracksctrl.SetLineCy(100);
+	thumb_display.owner = this;
 	
 	LoadTracks();
 	RefreshTracks();
@@ -37,41 +31,7 @@ QuantumMinigolf::QuantumMinigolf() {
 }
 
 void QuantumMinigolf::LoadTracks() {
-	for(int i = 0; i < tracks_all_count; i++) {
-		int size = tracks_all_length[i];
-		
-		String name = tracks_all_files[i];
-		
-		int a = name.Find(".");
-		int b = name.Find("_soft");
-		int c = name.Find("_hard");
-		bool soft = b != -1;
-		bool hard = c != -1;
-		String title = soft ? name.Left(b) : hard ? name.Left(c) : name.Left(a);
-		LOG(title << ": " << name);
-		
-		MemReadStream bmpbz2_stream(tracks_all[i], tracks_all_length[i]);
-		
-		StringStream bmp_stream;
-		
-		BZ2Decompress(bmp_stream, bmpbz2_stream);
-		
-		BMPRaster bmp;
-		
-		bmp_stream.Seek(0);
-		bmp_stream.SetLoading();
-		
-		Image img = bmp.Load(bmp_stream);
-		
-		Track& t = tracks.GetAdd(title);
-		t.title = title;
-		if (soft)
-			t.soft = img;
-		else if (hard)
-			t.hard = img;
-		else
-			t.base = img;
-	}
+	LoadBuiltinTracks(tracks);
 	
 	for(int i = 0; i < tracks.GetCount(); i++) {
 		Track& t = tracks[i];
@@ -80,11 +40,48 @@ void QuantumMinigolf::LoadTracks() {
 	}
 }
 
+// GetThumbnail - track i scaled to the given height. Rescaling is slow, so
+// the thumbnails are kept until the height of the list rows changes.
+const Image& QuantumMinigolf::GetThumbnail(int i, int height) {
+	thumbs.SetCount(tracks.GetCount());
+	Image& thumb = thumbs[i];
+	const Image& img = tracks[i].potential;
+	Size sz = img.GetSize();
+	if (thumb.GetHeight() != height && sz.cx > 0 && sz.cy > 0 && height > 0)
+		thumb = Rescale(img, Size(sz.cx * height / sz.cy, height));
+	return thumb;
+}
+
+// RefreshTracks - list the tracks, their thumbnails are rescaled from the
+// current potentials when the list is painted again
 void QuantumMinigolf::RefreshTracks() {
+	thumbs.Clear();
+	tracksctrl.SetCount(tracks.GetCount());
 	for(int i = 0; i < tracks.GetCount(); i++) {
 		tracksctrl.Set(i, 0, i);
-		tracksctrl.SetDisplay(i, 0, Single<TrackImage>());
+		tracksctrl.SetDisplay(i, 0, thumb_display);
 	}
+	tracksctrl.Refresh();
+}
+
+// LoadTrackPack - add the tracks of a pack to the list, replacing those of the
+// same title, e.g. to swap in a new version of a course library
+bool QuantumMinigolf::LoadTrackPack(const String& path) {
+	TrackPack pack;
+	if (!pack.Open(path))
+		return false;
+	pack.Load(tracks);
+	RefreshTracks();
+	SetTrack();
+	return true;
+}
+
+// SetBarrier - scale the finite barriers of every track, see ComposePotential
+void QuantumMinigolf::SetBarrier(double barrier) {
+	for (int i = 0; i < tracks.GetCount(); i++)
+		ComposePotential(tracks[i], barrier);
+	RefreshTracks();
+	SetTrack();
 }
 
 void QuantumMinigolf::SetTrack() {
@@ -1,7 +1,8 @@
 #ifndef _QuantumMinigolf_QuantumMinigolf_h
 #define _QuantumMinigolf_QuantumMinigolf_h
 
-#include "QuantumSimulator.h"
+#include <CtrlLib/CtrlLib.h>
+#include <QuantumSim/QuantumSim.h>
 
 #define IMAGECLASS Imgs
 #define IMAGEFILE <QuantumMinigolf/QuantumMinigolf.iml>
@@ -10,32 +11,49 @@
 #define QMG_WIN 0
 #define QMG_LOSE 1
 
-// dimensions of the playing field
-#define WIDTH 640
-#define HEIGHT 320
-
-struct Track : Moveable<Track> {
-	Image base, soft, hard;
-	String title;
-};
+#define GAME_DT 0.0001 // the timestep the game was tuned for
 
 class MinigolfDrawer : public Ctrl {
 	
 	enum {STATE_AIMING, STATE_SETVELOCITY, STATE_HITTING, STATE_MOVING, STATE_FINISHED};
 	enum {HACKSTATE_NULL, HACKSTATE_COLOR, HACKSTATE_SATURATED_PARTIAL, HACKSTATE_SATURATED_FULL, HACKSTATE_COUNT, HACKSTATE_MOVIE};
 	
-	QuantumSimulator simulator;
-	SpinLock lock;
+	PropagatorCache propagators;     // of the tracks played, for every grid and timestep used
+	One<QuantumSimulator> simulator; // runs on its own grid, see SetGrid
+	TripleBuffer<PsiFrame> snapshot; // psi as last published by Run() for Paint()
+	Atomic measure;                  // set by a click, Run() collapses the wave
+	Atomic observe;                  // set by F2, Run() has the simulator compute the observables
+	Observables observed;            // the last ones Paint() took from the simulator
+	// the frames Run() publishes while the ball moves, see SetRecordDir. The
+	// two take turns, so a shot does not wait for the file of the one before.
+	PsiRecorder recorder[2];
+	int recording;                   // the recorder of the shot, -1 if none
+	String record_dir;
+	int shots;
 	Track* track;
-	Image cmap, cmap_mono;
+	Image background;    // track and hole under the moving wave at grid size, see RenderTrackBackground
+	Image wave;          // the last rendered wave, its pixels are reused by the next Paint
 	double racket_rphi;
-	int holex, holey, holer;
+	Hole hole;
 	int ballx, bally, ballr;
 	int racket_r, racket_l;
 	int state;
 	int hack_state;
 	int res;
+	int frame_rate;      // repaints per second
+	int steps_per_frame; // split steps per displayed frame, if sim_rate is 0
+	double sim_rate;     // simulated time per wall-clock second, 0 = fixed steps per frame
+	double dt;           // timestep of the simulator
+	int integrator;      // INTEGRATOR_LIE ..
+	int measure_rule;    // MEASURE_CLASSIC unless set, see SetMeasurementRule
 	bool running, stopped;
+	bool profile_overlay; // timings of the phases over the field, PROFILE builds only
+	
+	int64 StepsDue(int64 elapsed_us) const;
+	void ResetBall();
+	int GetStyle() const;
+	void PaintField(Draw& w);
+	void PaintProfile(Draw& w) const;
 	
 public:
 	typedef MinigolfDrawer CLASSNAME;
@@ -48,8 +66,26 @@ public:
 	void Refresher();
 	void StopMoving();
 	void SetTrack(Track& track);
+	void Restart();
+	void SetGrid(Size sz);
+	void SetIntegrator(int integrator, double dt);
+	// SetMeasurementRule - how the ball is measured, the game keeps the rule it
+	// was tuned with unless told otherwise, see Measure.h
+	void SetMeasurementRule(int rule);
+	
+	void SetFrameRate(int fps);
+	void SetStepsPerFrame(int n);
+	void SetSimRate(double rate);
+	// SetProfileOverlay - show the rolling timings of the phases of a frame,
+	// see Profile.h. F3 toggles it, F2 toggles a line of observables of the
+	// moving wave.
+	void SetProfileOverlay(bool b) {profile_overlay = b;}
+	// SetRecordDir - record every shot into dir as shot001.qrec .., see
+	// Recorder.h. Empty stops recording.
+	void SetRecordDir(const String& dir) {record_dir = dir;}
 	
 	virtual void Paint(Draw& w);
+	virtual bool Key(dword key, int count);
 	virtual void MouseMove(Point p, dword keyflags);
 	virtual void LeftDown(Point p, dword keyflags);
 	virtual void RightDown(Point p, dword keyflags);
@@ -57,7 +93,13 @@ public:
 
 };
 
+class QuantumMinigolf;
+
+// TrackImage - paints the thumbnail of the track in the cell from the window
+// that owns the list
 struct TrackImage : public Display {
+	QuantumMinigolf* owner;
+	
 	virtual void Paint(Draw& w, const Rect& r, const Value& q, Color ink, Color paper, dword style) const;
 };
 
@@ -66,6 +108,8 @@ struct TrackImage : public Display {
 
 class QuantumMinigolf : public WithQuantumMinigolfLayout<TopWindow> {
 	VectorMap<String, Track> tracks;
+	Vector<Image> thumbs;    // of the tracks in the list, see GetThumbnail
+	TrackImage thumb_display;
 	
 	void LoadTracks();
 public:
@@ -74,13 +118,17 @@ public:
 	
 	void RefreshTracks();
 	void SetTrack();
+	void SetBarrier(double barrier);
+	bool LoadTrackPack(const String& path);
+	void SetGrid(Size sz) {game.SetGrid(sz);}
+	void SetIntegrator(int integrator, double dt) {game.SetIntegrator(integrator, dt);}
+	void SetMeasurementRule(int rule) {game.SetMeasurementRule(rule);}
+	void SetProfileOverlay(bool b) {game.SetProfileOverlay(b);}
+	void SetRecordDir(const String& dir) {game.SetRecordDir(dir);}
 	
 	const Image& GetTrack(int i) const {return tracks[i].base;}
+	const Image& GetThumbnail(int i, int height);
 	
 };
 
-inline QuantumMinigolf& GetQuantumMinigolf() {return Single<QuantumMinigolf>();}
-
-
-
 #endif
@@ -7,5 +7,68 @@
 
 GUI_APP_MAIN
 {
-	QuantumMinigolf().Run();
+	QuantumMinigolf app;
+	
+	// -grid <w>x<h> simulates on another grid than the 640x320 field,
+	// -integrator <name> and -dt <dt> select the split-step scheme,
+	// -barrier <s> scales the finite barriers of the tracks, -pack <file> adds
+	// the tracks of a track pack. In builds with the PROFILE flag, -profile
+	// shows the timings of the phases of a frame and -trace <file.json> writes
+	// them as a Chrome trace when the game is closed. -record <dir> records the
+	// wave of every shot into dir, see QuantumMinigolfCli -play. -measure-rule born
+	// measures the ball from |psi|^2 instead of the classic rule of the game.
+	const Vector<String>& cmd = CommandLine();
+	int integrator = INTEGRATOR_LIE;
+	double dt = GAME_DT;
+	String trace;
+	for (int i = 0; i < cmd.GetCount(); i++)
+		if (cmd[i] == "-profile")
+			app.SetProfileOverlay(true);
+	for (int i = 0; i + 1 < cmd.GetCount(); i++)
+		if (cmd[i] == "-grid") {
+			Size sz = ScanGridSize(cmd[i + 1]);
+			if (sz.cx > 0)
+				app.SetGrid(sz);
+		}
+		else if (cmd[i] == "-integrator")
+			integrator = max(FindIntegrator(cmd[i + 1]), 0);
+		else if (cmd[i] == "-pack") {
+			if (!app.LoadTrackPack(cmd[i + 1]))
+				Exclamation("Cannot open track pack " + DeQtf(cmd[i + 1]));
+		}
+		else if (cmd[i] == "-barrier") {
+			double v = StrDbl(cmd[i + 1]);
+			if (!IsNull(v) && v >= 0)
+				app.SetBarrier(v);
+		}
+		else if (cmd[i] == "-trace")
+			trace = cmd[i + 1];
+		else if (cmd[i] == "-record")
+			app.SetRecordDir(cmd[i + 1]);
+		else if (cmd[i] == "-measure-rule") {
+			int rule = FindMeasureRule(cmd[i + 1]);
+			if (rule >= 0)
+				app.SetMeasurementRule(rule);
+		}
+		else if (cmd[i] == "-dt") {
+			double v = StrDbl(cmd[i + 1]);
+			if (!IsNull(v) && v > 0)
+				dt = v;
+		}
+	
+	if (integrator != INTEGRATOR_LIE || dt != GAME_DT)
+		app.SetIntegrator(integrator, dt);
+	
+	SetProfileThreadName("gui");
+	if (trace.GetCount())
+		StartProfileTrace();
+	
+	app.Run();
+	
+	if (trace.GetCount()) {
+		StopProfileTrace();
+		if (!SaveProfileTrace(trace))
+			Exclamation(IsProfileBuild() ? "Cannot write " + DeQtf(trace)
+			                             : String("Built without the PROFILE flag, no trace written"));
+	}
 }
@@ -0,0 +1,649 @@
+#include <QuantumSim/QuantumSim.h>
+
+// QuantumMinigolfCli - fire a single shot on a track and propagate it flat out,
+// without the GUI. Writes the final wavefunction and the norm history.
+
+static void Usage() {
+	Cout() << "Usage: QuantumMinigolfCli [options]\n"
+	          "  -track <name|file.bmp>   built-in or pack track, or potential bitmap (default: empty)\n"
+	          "  -pack <file>             add the tracks of a track pack\n"
+	          "  -savepack <file>         write all tracks known, including -track, into a track pack\n"
+	          "  -x <x> -y <y>            ball position on the 640x320 field (default: the track's)\n"
+	          "  -angle <deg>             racket angle, 0 = racket right of the ball (default: 0)\n"
+	          "  -speed <v>               club speed as fraction of the maximum, 0..1 (default: 1)\n"
+	          "  -width <w>               width of the wave packet (default: 10)\n"
+	          "  -steps <n>               number of split steps (default: 1000)\n"
+	          "  -dt <dt>                 timestep (default: the track's or 0.0001)\n"
+	          "  -grid <w>x<h>            resample the track to this grid (default: the track's or its size)\n"
+	          "  -barrier <s>             scale the finite barriers of the track (default: the track's)\n"
+	          "  -psi <file>              write the final wavefunction\n"
+	          "  -norm <file>             write the norm after every step\n"
+	          "  -observe <file>          write <x>, <k>, the energy and the hole probability of every step\n"
+	          "  -stop-hole <p>           stop once the hole holds p of the norm\n"
+	          "  -record <file.qrec>      record psi while stepping into a compressed recording\n"
+	          "  -record-every <n>        steps between the recorded frames (default: 10)\n"
+	          "  -quant <q>               quantization of the recording: byte (default) or half\n"
+	          "  -keyframes <n>           frames between the keyframes of the recording (default: 30)\n"
+	          "  -play <file.qrec>        print a recording, write frame -frame of it to -psi\n"
+	          "  -frame <i>               frame of -play (default: the last)\n"
+	          "  -measure <n>             print n measured positions (grid cells) of the final psi\n"
+	          "  -seed <s>                seed of the measurements (default: random)\n"
+	          "  -measure-rule <r>        born (default, |psi|^2) or classic (the game's)\n"
+	          "  -threads <n>             threads per simulation, 0 = all cores (default: 1)\n"
+	          "  -plan <rigor>            FFTW planning: estimate, measure (default), patient, exhaustive\n"
+	          "  -wisdom <dir>            directory of the FFTW wisdom cache, \"none\" to disable\n"
+	          "  -idle <eps>              skip tiles holding less than eps of the norm, 0 = never (default: 1e-12)\n"
+	          "  -kernel <name>           scalar, sse3, avx2, avx512 or auto (default)\n"
+	          "  -bench                   time the layout sensitive paths in ns per cell\n"
+	          "  -integrator <name>       lie (default), strang or yoshida\n"
+	          "  -precision <p>           float (default) or double psi and FFTs\n"
+	          "  -accuracy                error of each integrator at multiples of dt after -steps * dt\n"
+	          "  -winmap <file>           sweep angle and speed, write the win probability as CSV\n"
+	          "  -angles <a0>:<a1>:<n>    angles of the sweep in degrees (default: -45:45:9)\n"
+	          "  -speeds <v0>:<v1>:<n>    speeds of the sweep (default: 0.2:1:9)\n"
+	          "  -times <t1>,<t2>,...     steps after which the sweep measures (default: -steps)\n"
+	          "  -batch <n>               shots of the sweep stepped together per thread (default: 1)\n"
+	          "  -trace <file.json>       time the phases of the shot, write them as a Chrome trace\n"
+	          "                           (builds with the PROFILE flag only)\n"
+	          "  -list                    list the built-in tracks\n";
+}
+
+// SavePsi - binary dump of the wavefunction:
+// "QPSI", int32 width, int32 height, then width * height complex floats (re, im), rows first
+static bool SavePsi(const String& path, const float *psi, int width, int height) {
+	FileOut out(path);
+	if (!out)
+		return false;
+	
+	out.Put("QPSI", 4);
+	out.Put32le(width);
+	out.Put32le(height);
+	out.Put(psi, 2 * width * height * sizeof(float));
+	
+	out.Close();
+	return !out.IsError();
+}
+
+template <class Real>
+static bool SavePsi(const String& path, const QuantumSimulator_<Real>& sim) {
+	Buffer<float> data(2 * sim.GetWidth() * sim.GetHeight());
+	sim.GetPsi(data);
+	return SavePsi(path, data, sim.GetWidth(), sim.GetHeight());
+}
+
+// Play - print what a recording holds, write one of its frames
+static void Play(const String& path, int frame, const String& psi_path) {
+	PsiRecording rec;
+	if (!rec.Open(path)) {
+		Cerr() << "Cannot open recording " << path << '\n';
+		SetExitCode(1);
+		return;
+	}
+	int keys = 0;
+	for (int i = 0; i < rec.GetCount(); i++)
+		keys += rec.IsKeyframe(i);
+	int64 raw = 2 * sizeof(float) * (int64)rec.GetWidth() * rec.GetHeight() * rec.GetCount();
+	int64 size = GetFileLength(path);
+	Cout() << rec.GetWidth() << "x" << rec.GetHeight() << ", " << GetQuantName(rec.GetQuant())
+	       << ", dt " << rec.GetDt() << ", " << rec.GetCount() << " frames (" << keys << " keyframes), steps "
+	       << (rec.GetCount() ? rec.GetStep(0) : 0) << " .. " << (rec.GetCount() ? rec.GetStep(rec.GetCount() - 1) : 0)
+	       << ", " << size << " bytes, " << Format("%.1f", size > 0 ? (double)raw / size : 0.0)
+	       << " times smaller than float psi\n";
+	
+	if (IsNull(frame))
+		frame = rec.GetCount() - 1;
+	PsiFrame f;
+	int64 t0 = usecs();
+	if (!rec.Read(frame, f)) {
+		Cerr() << "Cannot read frame " << frame << " of " << path << '\n';
+		SetExitCode(1);
+		return;
+	}
+	Cout() << "frame " << frame << ": step " << f.step << ", norm " << Format("%.6g", f.norm)
+	       << ", decoded in " << Format("%.3f", (usecs() - t0) / 1e3) << " ms\n";
+	
+	if (!IsNull(psi_path) && !SavePsi(psi_path, f.psi, f.width, f.height)) {
+		Cerr() << "Failed to write " << psi_path << '\n';
+		SetExitCode(1);
+	}
+}
+
+// Bench - time the loops that walk the whole grid. Before psi was stored row
+// by row, the snapshot copy and the potential extraction strided by height.
+template <class Real>
+static void Bench(QuantumSimulator_<Real>& sim, const Track& track, const Shot& shot) {
+	int cells = sim.GetWidth() * sim.GetHeight();
+	PsiFrame frame;
+	int n = 20;
+	
+	int64 t0 = usecs();
+	for (int i = 0; i < n; i++)
+		sim.Snapshot(frame);
+	double snapshot = (usecs() - t0) * 1e3 / n / cells;
+	
+	t0 = usecs();
+	for (int i = 0; i < n; i++)
+		sim.BuildPositionPropagator(track.potential);
+	double position = (usecs() - t0) * 1e3 / n / cells;
+	
+	shot.Fire(sim);
+	t0 = usecs();
+	for (int i = 0; i < n; i++)
+		sim.Step();
+	double step = (usecs() - t0) * 1e3 / n / cells;
+	
+	Cout() << Format("%s: snapshot %.2f ns/cell, position propagator %.2f ns/cell, step %.2f ns/cell\n",
+	                 sizeof(Real) == sizeof(float) ? "float" : "double", snapshot, position, step);
+}
+
+// Accuracy - propagate the shot for the same simulated time with every
+// integrator at 1, 2, 4, .. times dt and print the distance to a reference
+// run, Yoshida at dt / 4 in double precision, so the largest timestep within
+// an error can be picked. The last line is the float Yoshida run at dt / 4,
+// i.e. the error due to the precision alone.
+static void Accuracy(const Track& track, const Shot& shot, double dt, int steps, int threads) {
+	Size sz = track.base.GetSize();
+	
+	QuantumSimulator64 ref(sz.cx, sz.cy, dt / 4, threads);
+	ref.BuildPositionPropagator(track.potential);
+	ref.SetIntegrator(INTEGRATOR_YOSHIDA);
+	RunShot(ref, shot, 4 * steps);
+	
+	Cout() << "integrator,dt,steps,fft_pairs,error,seconds\n";
+	for (int integrator = 0; integrator < INTEGRATOR_COUNT; integrator++)
+		for (int m = 1; m <= steps && steps % m == 0; m *= 2) {
+			QuantumSimulator sim(sz.cx, sz.cy, dt * m, threads);
+			sim.BuildPositionPropagator(track.potential);
+			sim.SetIntegrator(integrator);
+			double seconds = RunShot(sim, shot, steps / m);
+			
+			Cout() << GetIntegratorName(integrator) << ',' << Format("%.6g", dt * m) << ','
+			       << steps / m << ',' << steps / m * GetIntegratorFfts(integrator) << ','
+			       << Format("%.3e", PsiDistance(sim, ref)) << ',' << Format("%.3f", seconds) << '\n';
+		}
+	
+	QuantumSimulator sim(sz.cx, sz.cy, dt / 4, threads);
+	sim.BuildPositionPropagator(track.potential);
+	sim.SetIntegrator(INTEGRATOR_YOSHIDA);
+	double seconds = RunShot(sim, shot, 4 * steps);
+	Cout() << "yoshida-float," << Format("%.6g", dt / 4) << ',' << 4 * steps << ','
+	       << 4 * steps * GetIntegratorFfts(INTEGRATOR_YOSHIDA) << ','
+	       << Format("%.3e", PsiDistance(sim, ref)) << ',' << Format("%.3f", seconds) << '\n';
+}
+
+// ScanSweep - parse "<from>:<to>:<count>"
+static bool ScanSweep(const String& s, double& from, double& to, int& count) {
+	Vector<String> part = Split(s, ':');
+	if (part.GetCount() != 3)
+		return false;
+	from = StrDbl(part[0]);
+	to = StrDbl(part[1]);
+	count = StrInt(part[2]);
+	return !IsNull(from) && !IsNull(to) && !IsNull(count) && count > 0;
+}
+
+static bool SaveWinMap(const String& path, const WinMap& map, const WinSweep& sweep) {
+	String s;
+	s << "angle,speed,step,p\n";
+	for (int a = 0; a < map.angles; a++)
+		for (int v = 0; v < map.speeds; v++)
+			for (int t = 0; t < map.times; t++)
+				s << Format("%.4g", sweep.GetAngle(a) * 180 / M_PI) << ','
+				  << Format("%.4g", sweep.GetSpeed(v)) << ','
+				  << sweep.times[t] << ','
+				  << Format("%.6g", map.Get(a, v, t)) << '\n';
+	return SaveFile(path, s);
+}
+
+static bool SaveNorm(const String& path, const Vector<double>& norm, double dt) {
+	String s;
+	s << "step,t,norm\n";
+	for (int i = 0; i < norm.GetCount(); i++)
+		s << i + 1 << ',' << Format("%.8g", (i + 1) * dt) << ',' << Format("%.10g", norm[i]) << '\n';
+	return SaveFile(path, s);
+}
+
+static bool SaveObservables(const String& path, const Vector<Observables>& obs, double dt) {
+	String s;
+	s << "step,t,norm,x,y,sx,sy,kx,ky,kinetic,potential,energy,hole\n";
+	for (const Observables& o : obs)
+		s << o.step << ',' << Format("%.8g", o.step * dt) << ',' << Format("%.10g", o.norm) << ','
+		  << Format("%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,", o.x, o.y, o.sx, o.sy, o.kx, o.ky)
+		  << Format("%.8g,%.8g,%.8g,%.8g", o.kinetic, o.potential, o.GetEnergy(), o.hole) << '\n';
+	return SaveFile(path, s);
+}
+
+// Propagate - fire the shot and propagate it in precision Real, then write
+// what was asked for. The potential is taken from pack as it is, if it has
+// one for this grid.
+template <class Real>
+static void Propagate(const Track& track, const Shot& shot, int steps, double dt, int threads,
+                      double idle, int integrator, bool bench, int measure, int measure_rule,
+                      const String& seed,
+                      const String& psi_path, const String& norm_path,
+                      const String& observe_path, double stop_hole,
+                      const String& record_path, int record_every, int quant, int keyframes,
+                      const TrackPack& pack, int pack_track) {
+	Size sz = track.base.GetSize();
+	int64 t0 = usecs();
+	QuantumSimulator_<Real> sim(sz.cx, sz.cy, dt, threads > 0 ? threads : CPU_Cores());
+	Cout() << "Setup took " << Format("%.3f", (usecs() - t0) / 1e6) << " s\n";
+	const byte *cells = pack_track >= 0 ? pack.GetPotential(pack_track, sz, sim.GetStride()) : NULL;
+	if (cells) {
+		sim.SetPotential(cells);
+		Cout() << "Potential mapped from the track pack\n";
+	}
+	else
+		sim.BuildPositionPropagator(track.potential);
+	sim.SetIdleThreshold(idle);
+	sim.SetIntegrator(integrator);
+	
+	if (bench) {
+		Bench(sim, track, shot);
+		return;
+	}
+	
+	PsiRecorder recorder;
+	if (!IsNull(record_path) && !recorder.Open(record_path, sz.cx, sz.cy, dt, quant, keyframes)) {
+		Cerr() << "Cannot record into " << record_path << '\n';
+		SetExitCode(1);
+		return;
+	}
+	
+	// the observables are taken from the ring by another thread while stepping,
+	// as a display would
+	Vector<Observables> obs;
+	Thread reader;
+	Atomic done(0);
+	if (!IsNull(observe_path) || stop_hole > 0) {
+		sim.SetObservables(true);
+		sim.SetObservedHole(track.hole);
+		reader.Run([&] {
+			RingBuffer<Observables>& ring = sim.GetObservableRing();
+			for (;;) {
+				bool last = done;
+				while (ring.Get(obs.Add()))
+					;
+				obs.Drop();
+				if (last)
+					break;
+				Sleep(1);
+			}
+		});
+	}
+	
+	Vector<double> norm;
+	double seconds = RunShot(sim, shot, steps, &norm, stop_hole,
+	                         recorder.IsOpen() ? &recorder : NULL, record_every);
+	steps = (int)sim.GetStepCount();
+	
+	if (recorder.IsOpen()) {
+		int64 t0 = usecs();
+		if (!recorder.Close()) {
+			Cerr() << "Failed to write " << record_path << '\n';
+			SetExitCode(1);
+		}
+		else
+			Cout() << recorder.GetFrames() << " frames recorded, " << recorder.GetDropped()
+			       << " dropped, " << GetFileLength(record_path) << " bytes, writer done "
+			       << Format("%.3f", (usecs() - t0) / 1e6) << " s after the last step\n";
+	}
+	
+	if (sim.IsObserving()) {
+		done = 1;
+		reader.Wait();
+		const Observables& o = sim.GetObservables();
+		Cout() << Format("<x> %.1f, <y> %.1f, spread %.1f x %.1f, <k> %.2f, %.2f, energy %.6g, "
+		                 "hole %.6f", o.x, o.y, o.sx, o.sy, o.kx, o.ky, o.GetEnergy(), o.hole);
+		if (sim.GetObservableRing().GetDropped())
+			Cout() << ", " << sim.GetObservableRing().GetDropped() << " steps dropped by the ring";
+		Cout() << '\n';
+	}
+	
+	Cout() << track.title << ": " << sz.cx << "x" << sz.cy << ", "
+	       << (sizeof(Real) == sizeof(float) ? GetSplitStepKernelName(GetSplitStepKernel()) : "scalar")
+	       << " kernel, " << GetIntegratorName(integrator) << " integrator, "
+	       << (sizeof(Real) == sizeof(float) ? "float" : "double") << ", "
+	       << sim.GetThreads() << " threads, " << steps << " steps in "
+	       << Format("%.3f", seconds) << " s, "
+	       << Format("%.1f", seconds > 0 ? steps / seconds : 0.0) << " steps/s, final norm "
+	       << Format("%.6g", sim.GetNorm()) << '\n';
+	
+	TileStats st = sim.GetTileStats();
+	Cout() << Format("%d tiles: %.1f active per step, last step %d active, %d wall, %d idle\n",
+	                 st.tiles, st.mean_active, st.active, st.wall, st.idle);
+	
+	if (measure > 0) {
+		PositionSampler sampler;
+		Rng rng(IsNull(seed) ? Random64() : ScanInt64(seed));
+		int64 t0 = usecs();
+		sampler.Build(sim, measure_rule);
+		int64 t1 = usecs();
+		for (int i = 0; i < measure; i++) {
+			Point p = sampler.Sample(rng);
+			if (IsNull(p))
+				break;
+			Cout() << p.x << ',' << p.y << '\n';
+		}
+		Cerr() << Format("sampler built in %.3f ms, %d samples in %.3f ms\n",
+		                 (t1 - t0) / 1e3, measure, (usecs() - t1) / 1e3);
+	}
+	
+	if (!IsNull(psi_path) && !SavePsi(psi_path, sim)) {
+		Cerr() << "Failed to write " << psi_path << '\n';
+		SetExitCode(1);
+	}
+	
+	if (!IsNull(norm_path) && !SaveNorm(norm_path, norm, dt)) {
+		Cerr() << "Failed to write " << norm_path << '\n';
+		SetExitCode(1);
+	}
+	
+	if (!IsNull(observe_path) && !SaveObservables(observe_path, obs, dt)) {
+		Cerr() << "Failed to write " << observe_path << '\n';
+		SetExitCode(1);
+	}
+}
+
+CONSOLE_APP_MAIN
+{
+	const Vector<String>& cmd = CommandLine();
+	
+	String track_name, psi_path, norm_path, savepack_path, observe_path;
+	double stop_hole = 0;
+	TrackPack pack;
+	Shot shot;
+	Point ball = Null;
+	int steps = 1000;
+	int threads = 1;
+	int measure = 0;
+	int measure_rule = MEASURE_BORN;
+	String seed;
+	String winmap_path;
+	String trace_path;
+	String record_path, play_path;
+	int record_every = 10;
+	int quant = PSI_QUANT_BYTE;
+	int keyframes = 30;
+	int frame = Null;
+	WinSweep sweep;
+	bool bench = false;
+	bool accuracy = false;
+	int integrator = INTEGRATOR_LIE;
+	double dt = Null;
+	double idle = 1e-12;
+	String precision = "float";
+	double barrier = Null;
+	Size grid(0, 0);
+	
+	VectorMap<String, Track> tracks;
+	LoadBuiltinTracks(tracks);
+	
+	for (int i = 0; i < cmd.GetCount(); i++) {
+		String opt = cmd[i];
+		if (opt == "-bench") {
+			bench = true;
+			continue;
+		}
+		if (opt == "-accuracy") {
+			accuracy = true;
+			continue;
+		}
+		if (opt == "-list") {
+			for (int j = 0; j < tracks.GetCount(); j++)
+				Cout() << tracks.GetKey(j) << '\n';
+			return;
+		}
+		if (i + 1 >= cmd.GetCount()) {
+			Usage();
+			SetExitCode(1);
+			return;
+		}
+		String val = cmd[++i];
+		if (opt == "-track")      track_name = val;
+		else if (opt == "-x")     ball.x = StrInt(val);
+		else if (opt == "-y")     ball.y = StrInt(val);
+		else if (opt == "-pack") {
+			if (!pack.Open(val)) {
+				Cerr() << "Cannot open track pack " << val << '\n';
+				SetExitCode(1);
+				return;
+			}
+			pack.Load(tracks);
+		}
+		else if (opt == "-savepack") savepack_path = val;
+		else if (opt == "-angle") shot.phi = StrDbl(val) * M_PI / 180;
+		else if (opt == "-speed") shot.v = StrDbl(val);
+		else if (opt == "-width") shot.w = StrDbl(val);
+		else if (opt == "-steps") steps = StrInt(val);
+		else if (opt == "-dt")    dt = StrDbl(val);
+		else if (opt == "-grid") {
+			grid = ScanGridSize(val);
+			if (grid.cx <= 0) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+		}
+		else if (opt == "-barrier") barrier = StrDbl(val);
+		else if (opt == "-threads") threads = StrInt(val);
+		else if (opt == "-idle")  idle = StrDbl(val);
+		else if (opt == "-wisdom") SetFftwWisdomDir(val == "none" ? String() : val);
+		else if (opt == "-plan") {
+			unsigned flags = FindFftwPlanning(val);
+			if (flags == (unsigned)-1) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+			SetFftwPlanning(flags);
+		}
+		else if (opt == "-psi")   psi_path = val;
+		else if (opt == "-norm")  norm_path = val;
+		else if (opt == "-observe") observe_path = val;
+		else if (opt == "-stop-hole") stop_hole = StrDbl(val);
+		else if (opt == "-record") record_path = val;
+		else if (opt == "-record-every") record_every = StrInt(val);
+		else if (opt == "-keyframes") keyframes = StrInt(val);
+		else if (opt == "-play")  play_path = val;
+		else if (opt == "-frame") frame = StrInt(val);
+		else if (opt == "-measure-rule") {
+			measure_rule = FindMeasureRule(val);
+			if (measure_rule < 0) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+		}
+		else if (opt == "-quant") {
+			quant = FindQuant(val);
+			if (quant < 0) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+		}
+		else if (opt == "-measure") measure = StrInt(val);
+		else if (opt == "-seed")  seed = val;
+		else if (opt == "-winmap") winmap_path = val;
+		else if (opt == "-trace") trace_path = val;
+		else if (opt == "-batch") sweep.batch = StrInt(val);
+		else if (opt == "-angles" || opt == "-speeds") {
+			bool ok = opt == "-angles" ? ScanSweep(val, sweep.angle0, sweep.angle1, sweep.angles)
+			                           : ScanSweep(val, sweep.speed0, sweep.speed1, sweep.speeds);
+			if (!ok) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+			if (opt == "-angles") {
+				sweep.angle0 *= M_PI / 180;
+				sweep.angle1 *= M_PI / 180;
+			}
+		}
+		else if (opt == "-times") {
+			for (const String& t : Split(val, ',')) {
+				int n = StrInt(t);
+				if (IsNull(n) || n <= 0) {
+					Usage();
+					SetExitCode(1);
+					return;
+				}
+				sweep.times.Add(n);
+			}
+			Sort(sweep.times);
+		}
+		else if (opt == "-integrator") {
+			integrator = FindIntegrator(val);
+			if (integrator < 0) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+		}
+		else if (opt == "-precision") {
+			if (val != "float" && val != "double") {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+			precision = val;
+		}
+		else if (opt == "-kernel") {
+			if (!SetSplitStepKernel(FindSplitStepKernel(val))) {
+				Cerr() << "Kernel " << val << " is not available\n";
+				SetExitCode(1);
+				return;
+			}
+		}
+		else {
+			Usage();
+			SetExitCode(1);
+			return;
+		}
+	}
+	
+	if (!IsNull(play_path)) {
+		Play(play_path, frame, psi_path);
+		return;
+	}
+	
+	if (IsNull(track_name))
+		track_name = "empty";
+	
+	Track track;
+	int q = tracks.Find(track_name);
+	if (q >= 0)
+		track = tracks[q];
+	else if (LoadTrackFile(track_name, track))
+		tracks.GetAdd(track.title) = track;
+	else {
+		Cerr() << "Unknown track " << track_name << '\n';
+		SetExitCode(1);
+		return;
+	}
+	
+	if (!IsNull(savepack_path)) {
+		int64 t0 = usecs();
+		if (!SaveTrackPack(savepack_path, tracks)) {
+			Cerr() << "Failed to write " << savepack_path << '\n';
+			SetExitCode(1);
+		}
+		else
+			Cout() << tracks.GetCount() << " tracks written in "
+			       << Format("%.3f", (usecs() - t0) / 1e6) << " s\n";
+		return;
+	}
+	
+	// the index of the track in the pack, as long as its potential is the packed one
+	int pack_track = -1;
+	for (int i = 0; i < pack.GetCount() && q >= 0; i++)
+		if (pack.GetTitle(i) == track_name)
+			pack_track = i;
+	
+	if (!IsNull(barrier) && barrier != track.barrier) {
+		ComposePotential(track, barrier);
+		pack_track = -1;
+	}
+	
+	if (grid.cx <= 0)
+		grid = track.grid;
+	if (grid.cx > 0 && grid != track.base.GetSize())
+		track = ResampleTrack(track, grid);
+	
+	if (IsNull(dt))
+		dt = track.dt > 0 ? track.dt : 0.0001;
+	shot.ballx = IsNull(ball.x) ? track.ball.x : ball.x;
+	shot.bally = IsNull(ball.y) ? track.ball.y : ball.y;
+	
+	Size sz = track.base.GetSize();
+	
+	if (accuracy) {
+		Accuracy(track, shot, dt, steps, threads > 0 ? threads : CPU_Cores());
+		return;
+	}
+	
+	if (!IsNull(winmap_path)) {
+		sweep.hole = track.hole;
+		sweep.ballx = shot.ballx;
+		sweep.bally = shot.bally;
+		sweep.w = shot.w;
+		sweep.threads = threads;
+		sweep.integrator = integrator;
+		if (sweep.times.IsEmpty())
+			sweep.times.Add(steps);
+		
+		WinMap map;
+		int64 t0 = usecs();
+		ComputeWinMap(map, track, sz, dt, sweep);
+		double seconds = (usecs() - t0) / 1e6;
+		
+		int best = 0;
+		for (int i = 1; i < map.p.GetCount(); i++)
+			if (map.p[i] > map.p[best])
+				best = i;
+		int shots = map.angles * map.speeds;
+		Cout() << shots << " shots in " << Format("%.3f", seconds) << " s, best "
+		       << Format("p = %.4f at angle %.1f, speed %.3f, step %d",
+		                 map.p.GetCount() ? map.p[best] : 0.0,
+		                 sweep.GetAngle(best / map.times / map.speeds) * 180 / M_PI,
+		                 sweep.GetSpeed(best / map.times % map.speeds),
+		                 sweep.times[best % map.times]) << '\n';
+		
+		if (!SaveWinMap(winmap_path, map, sweep)) {
+			Cerr() << "Failed to write " << winmap_path << '\n';
+			SetExitCode(1);
+		}
+		return;
+	}
+	
+	if (!IsNull(trace_path)) {
+		if (!IsProfileBuild()) {
+			Cerr() << "Built without the PROFILE flag, -trace is not available\n";
+			SetExitCode(1);
+			return;
+		}
+		SetProfileThreadName("main");
+		StartProfileTrace();
+	}
+	
+	if (precision == "double")
+		Propagate<double>(track, shot, steps, dt, threads, idle, integrator, bench, measure, measure_rule,
+		                  seed, psi_path, norm_path, observe_path, stop_hole,
+		                  record_path, record_every, quant, keyframes, pack, pack_track);
+	else
+		Propagate<float>(track, shot, steps, dt, threads, idle, integrator, bench, measure, measure_rule,
+		                 seed, psi_path, norm_path, observe_path, stop_hole,
+		                 record_path, record_every, quant, keyframes, pack, pack_track);
+	
+	if (!IsNull(trace_path)) {
+		StopProfileTrace();
+		Cout() << Format("%-20s %8s %9s %9s %9s\n", "phase", "calls", "p50 us", "p99 us", "max us");
+		for (const ProfileStats& st : GetProfileStats())
+			Cout() << Format("%-20s %8d %9.1f %9.1f %9.1f\n", st.name, st.calls, st.p50, st.p99, st.max);
+		if (!SaveProfileTrace(trace_path)) {
+			Cerr() << "Failed to write " << trace_path << '\n';
+			SetExitCode(1);
+		}
+	}
+}
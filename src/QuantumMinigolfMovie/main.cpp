@@ -0,0 +1,215 @@
+#include <QuantumSim/QuantumSim.h>
+
+// QuantumMinigolfMovie - render the frames of a shot, or of a recording made
+// with QuantumMinigolfCli -record or the game, as the game paints them. The
+// simulation makes the frames while the ones before are rendered on all cores.
+
+static void Usage() {
+	Cout() << "Usage: QuantumMinigolfMovie [options] -png <dir> | -raw <file>\n"
+	          "  -png <dir>               write frame00000.png .. into dir\n"
+	          "  -raw <file>              write 8-bit RGB frames into one file or named pipe\n"
+	          "  -track <name|file.bmp>   built-in or pack track, or potential bitmap (default: empty)\n"
+	          "  -pack <file>             add the tracks of a track pack\n"
+	          "  -x <x> -y <y>            ball position on the 640x320 field (default: the track's)\n"
+	          "  -angle <deg>             racket angle, 0 = racket right of the ball (default: 0)\n"
+	          "  -speed <v>               club speed as fraction of the maximum, 0..1 (default: 1)\n"
+	          "  -width <w>               width of the wave packet (default: 10)\n"
+	          "  -dt <dt>                 timestep (default: the track's or 0.0001)\n"
+	          "  -grid <w>x<h>            resample the track to this grid (default: the track's or its size)\n"
+	          "  -barrier <s>             scale the finite barriers of the track (default: the track's)\n"
+	          "  -integrator <name>       lie (default), strang or yoshida\n"
+	          "  -threads <n>             threads of the simulation, 0 = all cores (default: 1)\n"
+	          "  -style <s>               plain (default), color, saturated, inverted or uncertainty,\n"
+	          "                           the looks of the hack key of the game\n"
+	          "  -frames <n>              number of frames (default: 250, or all of -play)\n"
+	          "  -every <n>               steps per frame, or recorded frames per frame with -play\n"
+	          "                           (default: 2, with -play 1)\n"
+	          "  -play <file.qrec>        render a recording over -track instead of simulating\n";
+}
+
+CONSOLE_APP_MAIN
+{
+	const Vector<String>& cmd = CommandLine();
+	
+	String track_name, png_path, raw_path, play_path;
+	TrackPack pack;
+	Shot shot;
+	Point ball = Null;
+	int threads = 1;
+	int integrator = INTEGRATOR_LIE;
+	int style = MOVIE_PLAIN;
+	int frames = Null;
+	int every = Null;
+	double dt = Null;
+	double barrier = Null;
+	Size grid(0, 0);
+	
+	VectorMap<String, Track> tracks;
+	LoadBuiltinTracks(tracks);
+	
+	for (int i = 0; i < cmd.GetCount(); i++) {
+		String opt = cmd[i];
+		if (i + 1 >= cmd.GetCount()) {
+			Usage();
+			SetExitCode(1);
+			return;
+		}
+		String val = cmd[++i];
+		if (opt == "-track")      track_name = val;
+		else if (opt == "-png")   png_path = val;
+		else if (opt == "-raw")   raw_path = val;
+		else if (opt == "-play")  play_path = val;
+		else if (opt == "-x")     ball.x = StrInt(val);
+		else if (opt == "-y")     ball.y = StrInt(val);
+		else if (opt == "-pack") {
+			if (!pack.Open(val)) {
+				Cerr() << "Cannot open track pack " << val << '\n';
+				SetExitCode(1);
+				return;
+			}
+			pack.Load(tracks);
+		}
+		else if (opt == "-angle") shot.phi = StrDbl(val) * M_PI / 180;
+		else if (opt == "-speed") shot.v = StrDbl(val);
+		else if (opt == "-width") shot.w = StrDbl(val);
+		else if (opt == "-dt")    dt = StrDbl(val);
+		else if (opt == "-grid") {
+			grid = ScanGridSize(val);
+			if (grid.cx <= 0) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+		}
+		else if (opt == "-barrier") barrier = StrDbl(val);
+		else if (opt == "-threads") threads = StrInt(val);
+		else if (opt == "-frames") frames = StrInt(val);
+		else if (opt == "-every") every = StrInt(val);
+		else if (opt == "-integrator" || opt == "-style") {
+			int v = opt == "-style" ? FindMovieStyle(val) : FindIntegrator(val);
+			if (v < 0) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+			(opt == "-style" ? style : integrator) = v;
+		}
+		else {
+			Usage();
+			SetExitCode(1);
+			return;
+		}
+	}
+	
+	if (IsNull(png_path) == IsNull(raw_path)) {
+		Usage();
+		SetExitCode(1);
+		return;
+	}
+	
+	if (IsNull(track_name))
+		track_name = "empty";
+	
+	Track track;
+	int q = tracks.Find(track_name);
+	if (q >= 0)
+		track = tracks[q];
+	else if (!LoadTrackFile(track_name, track)) {
+		Cerr() << "Unknown track " << track_name << '\n';
+		SetExitCode(1);
+		return;
+	}
+	if (!IsNull(barrier) && barrier != track.barrier)
+		ComposePotential(track, barrier);
+	
+	if (IsNull(every) || every < 1)
+		every = IsNull(play_path) ? 2 : 1;
+	
+	PsiRecording rec;
+	if (!IsNull(play_path)) {
+		if (!rec.Open(play_path)) {
+			Cerr() << "Cannot open recording " << play_path << '\n';
+			SetExitCode(1);
+			return;
+		}
+		grid = Size(rec.GetWidth(), rec.GetHeight());
+		frames = min(IsNull(frames) ? INT_MAX : frames, (rec.GetCount() + every - 1) / every);
+	}
+	else {
+		if (grid.cx <= 0)
+			grid = track.grid;
+		if (grid.cx > 0 && grid != track.base.GetSize())
+			track = ResampleTrack(track, grid);
+		grid = track.base.GetSize();
+		if (IsNull(frames))
+			frames = 250;
+	}
+	
+	if (IsNull(dt))
+		dt = track.dt > 0 ? track.dt : 0.0001;
+	shot.ballx = IsNull(ball.x) ? track.ball.x : ball.x;
+	shot.bally = IsNull(ball.y) ? track.ball.y : ball.y;
+	
+	MovieRenderer movie;
+	String path = IsNull(png_path) ? raw_path : png_path;
+	if (!movie.Open(path, IsNull(png_path) ? MOVIE_RAW : MOVIE_PNG, track, grid, style)) {
+		Cerr() << "Cannot write " << path << '\n';
+		SetExitCode(1);
+		return;
+	}
+	
+	// the frames are made here, one at a time, and rendered behind
+	int64 t0 = usecs();
+	int64 made = 0; // us spent making frames
+	if (rec.IsOpen()) {
+		for (int i = 0; i < frames; i++) {
+			PsiFrame& f = movie.Claim();
+			int64 t = usecs();
+			if (!rec.Read(i * every, f)) {
+				// the movie ends with the frames before
+				movie.Cancel();
+				movie.Close();
+				Cerr() << "Cannot read frame " << i * every << " of " << play_path << '\n';
+				SetExitCode(1);
+				return;
+			}
+			made += usecs() - t;
+			movie.Commit();
+		}
+	}
+	else {
+		QuantumSimulator sim(grid.cx, grid.cy, dt, threads > 0 ? threads : CPU_Cores());
+		sim.BuildPositionPropagator(track.potential);
+		sim.SetIntegrator(integrator);
+		
+		if (style == MOVIE_UNCERTAINTY)
+			FireUncertainty(sim, shot.bally);
+		else
+			shot.Fire(sim);
+		
+		for (int i = 0; i < frames; i++) {
+			PsiFrame& f = movie.Claim();
+			int64 t = usecs();
+			for (int j = 0; j < every && i > 0; j++)
+				sim.Step(IsMoviePositionFirst(style));
+			sim.Snapshot(f);
+			made += usecs() - t;
+			movie.Commit();
+		}
+	}
+	
+	if (!movie.Close()) {
+		Cerr() << "Failed to write " << path << '\n';
+		SetExitCode(1);
+		return;
+	}
+	
+	double seconds = (usecs() - t0) / 1e6;
+	Size sz = movie.GetFrameSize();
+	Cout() << movie.GetFrames() << " frames of " << sz.cx << "x" << sz.cy << " (" << GetMovieStyleName(style)
+	       << ") in " << Format("%.3f", seconds) << " s, " << Format("%.1f", seconds > 0 ? frames / seconds : 0.0)
+	       << " frames/s, " << Format("%.3f", made / 1e6) << " s of them making the frames\n";
+	if (!IsNull(raw_path))
+		Cout() << "e.g. ffmpeg -f rawvideo -pix_fmt rgb24 -s " << sz.cx << "x" << sz.cy
+		       << " -r 50 -i " << raw_path << " movie.mp4\n";
+}
@@ -0,0 +1,147 @@
+#include "QuantumSim.h"
+
+BatchSimulator::BatchSimulator(int width, int height, double dt, int count, int threads) {
+	this->dt = dt;
+	this->width = width;
+	this->height = height;
+	this->stride = GetRowStride(width);
+	this->count = count = max(count, 1);
+	this->threads = threads = max(threads, 1);
+	
+	size_t cells = (size_t)stride * height;
+	psi = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * cells * count);
+	
+	chunks = (int)((cells + KERNEL_CHUNK - 1) / KERNEL_CHUNK);
+	wave.Alloc(count);
+	partial.Alloc(chunks * count);
+	
+	PlanFftw(width, height, stride, threads, psi, fft, ifft, count);
+	
+	prop = NULL;
+	integrator = INTEGRATOR_LIE;
+	
+	Clear();
+}
+
+BatchSimulator::~BatchSimulator() {
+	DestroyFftw(fft, ifft);
+	
+	fftwf_free(psi);
+}
+
+void BatchSimulator::BuildPositionPropagator(const Image& V) {
+	prop = &Own();
+	own->BuildPosition(V);
+}
+
+Propagator& BatchSimulator::Own() {
+	if (!own) {
+		own = new Propagator(width, height, dt);
+		own->SetIntegrator(integrator);
+	}
+	return *own;
+}
+
+void BatchSimulator::SetIntegrator(int integrator) {
+	this->integrator = integrator;
+	if (own)
+		own->SetIntegrator(integrator);
+}
+
+void BatchSimulator::SetPropagator(const Propagator& p) {
+	ASSERT(p.width == width && p.height == height && p.dt == dt);
+	prop = &p;
+}
+
+void BatchSimulator::Clear() {
+	for (int i = 0; i < count; i++)
+		ClearWave(i);
+}
+
+void BatchSimulator::ClearWave(int i) {
+	memset(GetPsi(i), 0, sizeof(fftwf_complex) * stride * height);
+	wave[i].GaussNorm = 0;
+	wave[i].normlast = 1;
+	wave[i].steps = 0;
+}
+
+void BatchSimulator::GenGauss(int i, int cx, int cy, double kx, double ky, double w) {
+	wave[i].GaussNorm = FillGauss(GetPsi(i), width, height, stride, cx, cy, kx, ky, w);
+	wave[i].normlast = 1;
+	wave[i].steps = 0;
+}
+
+// PropagateMomentum - the rows of all waves are one sequence for the workers
+void BatchSimulator::PropagateMomentum(const fftwf_complex *kx, const fftwf_complex *ky) {
+	fftwf_execute(fft);
+	
+	ForChunks(height * count, max(KERNEL_CHUNK / stride, 1), threads, [&](int, int begin, int end) {
+		for (int r = begin; r < end; r++) {
+			int y = r % height;
+			ComplexMulScaled(GetPsi(r / height) + y * stride, kx, ky[y], width);
+		}
+	});
+	
+	fftwf_execute(ifft);
+}
+
+void BatchSimulator::PropagatePosition(const fftwf_complex *lut, double scale, bool renormalize) {
+	int cells = stride * height;
+	
+	ForChunks(chunks * count, 1, threads, [&](int item, int, int) {
+		int i = item / chunks;
+		int begin = item % chunks * KERNEL_CHUNK;
+		int end = min(begin + KERNEL_CHUNK, cells);
+		
+		if (wave[i].GaussNorm <= 0) {
+			partial[item] = 0;
+			return;
+		}
+		
+		// undo the FFT's scaling and last step's losses, as in QuantumSimulator::Step
+		double quench = renormalize ? scale / sqrt(wave[i].normlast) : scale;
+		partial[item] = LookupMulNorm(GetPsi(i) + begin, prop->potential + begin, lut,
+		                              quench, end - begin);
+	});
+	
+	for (int i = 0; i < count; i++) {
+		if (wave[i].GaussNorm <= 0)
+			continue;
+		
+		double norm = 0;
+		for (int c = 0; c < chunks; c++)
+			norm += partial[i * chunks + c];
+		
+		wave[i].normlast = norm / (wave[i].GaussNorm * INTENS * INTENS);
+		ASSERT(IsFin(wave[i].normlast));
+	}
+}
+
+void BatchSimulator::Step(bool position_first) {
+	double fft_scale = 1. / ((double)width * height);
+	const Propagator& pr = Prop();
+	
+	if (pr.stages) {
+		double scale = 1;
+		for (int i = 0; i < pr.stages; i++) {
+			const Propagator::Stage& s = pr.stage[i];
+			PropagatePosition(s.xlut, scale, i == 0);
+			if (s.momentum != 0) {
+				PropagateMomentum(s.kx, s.ky);
+				scale = fft_scale;
+			}
+		}
+	}
+	else if (position_first) {
+		PropagatePosition(pr.xlut, fft_scale, true);
+		PropagateMomentum(pr.kx, pr.ky);
+	}
+	else {
+		PropagateMomentum(pr.kx, pr.ky);
+		PropagatePosition(pr.xlut, fft_scale, true);
+	}
+	
+	for (int i = 0; i < count; i++)
+		if (wave[i].GaussNorm > 0)
+			wave[i].steps++;
+}
@@ -0,0 +1,146 @@
+#include "QuantumSim.h"
+
+#if defined(CPU_X86) && (defined(COMPILER_GCC) || defined(COMPILER_CLANG))
+#include <cpuid.h>
+#endif
+
+static StaticMutex s_planner;
+static unsigned    s_planning = FFTW_MEASURE;
+static String      s_wisdom_dir = ConfigFile("fftw-wisdom");
+
+void SetFftwPlanning(unsigned flags) {
+	s_planning = flags;
+}
+
+unsigned GetFftwPlanning() {
+	return s_planning;
+}
+
+unsigned FindFftwPlanning(const char *name) {
+	static const char *names[] = {"estimate", "measure", "patient", "exhaustive"};
+	static const unsigned flags[] = {FFTW_ESTIMATE, FFTW_MEASURE, FFTW_PATIENT, FFTW_EXHAUSTIVE};
+	for (int i = 0; i < __countof(names); i++)
+		if (strcmp(name, names[i]) == 0)
+			return flags[i];
+	return (unsigned)-1;
+}
+
+void SetFftwWisdomDir(const String& dir) {
+	Mutex::Lock __(s_planner);
+	s_wisdom_dir = dir;
+}
+
+String GetFftwWisdomDir() {
+	Mutex::Lock __(s_planner);
+	return s_wisdom_dir;
+}
+
+// CpuId - identifies the processor model, as wisdom measured on one CPU
+// is of little use on another
+static String CpuId() {
+	String id;
+#if defined(CPU_X86) && (defined(COMPILER_GCC) || defined(COMPILER_CLANG))
+	unsigned r[4];
+	if (__get_cpuid(0x80000000, &r[0], &r[1], &r[2], &r[3]) && r[0] >= 0x80000004)
+		for (unsigned leaf = 0x80000002; leaf <= 0x80000004; leaf++) {
+			__get_cpuid(leaf, &r[0], &r[1], &r[2], &r[3]);
+			id.Cat((const char *)r, sizeof(r));
+		}
+#endif
+	if (id.IsEmpty())
+		return "generic";
+	return FormatIntHex(GetHashValue(id), 8);
+}
+
+String GetFftwWisdomPath(int width, int height, int threads, int howmany, const char *ext) {
+	String dir = GetFftwWisdomDir();
+	if (IsNull(dir))
+		return Null;
+	String batch = howmany > 1 ? Format("-b%d", howmany) : String();
+	return AppendFileName(dir, Format("wisdom-%dx%d%s-t%d-%s.%s", width, height, batch, threads, CpuId(), ext));
+}
+
+template <class Real>
+static typename FftwOf<Real>::Plan Plan(int width, int height, int stride, int howmany,
+                                        typename FftwOf<Real>::Complex *data, int sign, unsigned flags) {
+	int n[2] = {height, width};
+	int embed[2] = {height, stride};
+	int dist = stride * height;
+	return FftwOf<Real>::PlanMany(2, n, howmany, data, embed, 1, dist, data, embed, 1, dist, sign, flags);
+}
+
+template <class Real>
+static void PlanFftwOf(int width, int height, int stride, int threads,
+                       typename FftwOf<Real>::Complex *data,
+                       typename FftwOf<Real>::Plan& fft, typename FftwOf<Real>::Plan& ifft, int howmany) {
+	typedef FftwOf<Real> F;
+	String path = GetFftwWisdomPath(width, height, threads, howmany, F::Name());
+	
+	Mutex::Lock __(s_planner);
+	
+	ONCELOCK {
+		F::InitThreads();
+	}
+	F::PlanWithThreads(threads);
+	
+	bool cached = false;
+	if (!IsNull(path)) {
+		// keep the cache file limited to this configuration
+		F::ForgetWisdom();
+		String wisdom = LoadFile(path);
+		cached = !wisdom.IsEmpty() && F::ImportWisdom(wisdom);
+	}
+	
+	// with matching wisdom, FFTW_WISDOM_ONLY returns at once; otherwise plan
+	unsigned flags = cached ? s_planning | FFTW_WISDOM_ONLY : s_planning;
+	
+	LOG("Initializing FFT engine (" << threads << " threads) ... ");
+	fft = Plan<Real>(width, height, stride, howmany, data, FFTW_FORWARD, flags);
+	if (!fft) {
+		cached = false;
+		fft = Plan<Real>(width, height, stride, howmany, data, FFTW_FORWARD, s_planning);
+	}
+	LOG("done");
+	
+	LOG("Initializing inverse FFT engine ... ");
+	ifft = Plan<Real>(width, height, stride, howmany, data, FFTW_BACKWARD, flags);
+	if (!ifft) {
+		cached = false;
+		ifft = Plan<Real>(width, height, stride, howmany, data, FFTW_BACKWARD, s_planning);
+	}
+	LOG("done");
+	
+	if (!cached && !IsNull(path)) {
+		char *wisdom = F::ExportWisdom();
+		if (wisdom) {
+			// write to a temporary file first, other processes may read the cache
+			String tmp = path + Format(".%08x.tmp", (int)Random());
+			RealizeDirectory(GetFileFolder(path));
+			if (SaveFile(tmp, wisdom) && !FileMove(tmp, path))
+				FileDelete(tmp);
+			free(wisdom);
+		}
+	}
+}
+
+void PlanFftw(int width, int height, int stride, int threads, fftwf_complex *data,
+              fftwf_plan& fft, fftwf_plan& ifft, int howmany) {
+	PlanFftwOf<float>(width, height, stride, threads, data, fft, ifft, howmany);
+}
+
+void PlanFftw(int width, int height, int stride, int threads, fftw_complex *data,
+              fftw_plan& fft, fftw_plan& ifft, int howmany) {
+	PlanFftwOf<double>(width, height, stride, threads, data, fft, ifft, howmany);
+}
+
+void DestroyFftw(fftwf_plan fft, fftwf_plan ifft) {
+	Mutex::Lock __(s_planner);
+	fftwf_destroy_plan(fft);
+	fftwf_destroy_plan(ifft);
+}
+
+void DestroyFftw(fftw_plan fft, fftw_plan ifft) {
+	Mutex::Lock __(s_planner);
+	fftw_destroy_plan(fft);
+	fftw_destroy_plan(ifft);
+}
@@ -0,0 +1,78 @@
+#ifndef _QuantumSim_Fftw_h_
+#define _QuantumSim_Fftw_h_
+
+// FFTW planning shared by all simulators. The planner is not thread-safe, so
+// every plan is created and destroyed under one lock. Plans are cached as FFTW
+// wisdom in files keyed by grid size, thread count and CPU; only the first
+// construction of a configuration pays for the planning.
+
+// FftwOf - the FFTW API of one precision, fftwf_* for float and fftw_* for
+// double. The simulators are templates over it.
+template <class Real> struct FftwOf;
+
+template <> struct FftwOf<float> {
+	typedef fftwf_complex Complex;
+	typedef fftwf_plan    Plan;
+	
+	static const char *Name()                 {return "fftwf";}
+	static Complex    *Malloc(size_t n)       {return (Complex *)fftwf_malloc(sizeof(Complex) * n);}
+	static void        Free(void *p)          {fftwf_free(p);}
+	static void        Execute(Plan p)        {fftwf_execute(p);}
+	static void        InitThreads()          {fftwf_init_threads();}
+	static void        PlanWithThreads(int n) {fftwf_plan_with_nthreads(n);}
+	static void        ForgetWisdom()         {fftwf_forget_wisdom();}
+	static bool        ImportWisdom(const char *s) {return fftwf_import_wisdom_from_string(s);}
+	static char       *ExportWisdom()         {return fftwf_export_wisdom_to_string();}
+	static Plan        PlanMany(int rank, const int *n, int howmany, Complex *in, const int *inembed,
+	                            int istride, int idist, Complex *out, const int *onembed,
+	                            int ostride, int odist, int sign, unsigned flags) {
+		return fftwf_plan_many_dft(rank, n, howmany, in, inembed, istride, idist,
+		                           out, onembed, ostride, odist, sign, flags);
+	}
+};
+
+template <> struct FftwOf<double> {
+	typedef fftw_complex Complex;
+	typedef fftw_plan    Plan;
+	
+	static const char *Name()                 {return "fftw";}
+	static Complex    *Malloc(size_t n)       {return (Complex *)fftw_malloc(sizeof(Complex) * n);}
+	static void        Free(void *p)          {fftw_free(p);}
+	static void        Execute(Plan p)        {fftw_execute(p);}
+	static void        InitThreads()          {fftw_init_threads();}
+	static void        PlanWithThreads(int n) {fftw_plan_with_nthreads(n);}
+	static void        ForgetWisdom()         {fftw_forget_wisdom();}
+	static bool        ImportWisdom(const char *s) {return fftw_import_wisdom_from_string(s);}
+	static char       *ExportWisdom()         {return fftw_export_wisdom_to_string();}
+	static Plan        PlanMany(int rank, const int *n, int howmany, Complex *in, const int *inembed,
+	                            int istride, int idist, Complex *out, const int *onembed,
+	                            int ostride, int odist, int sign, unsigned flags) {
+		return fftw_plan_many_dft(rank, n, howmany, in, inembed, istride, idist,
+		                          out, onembed, ostride, odist, sign, flags);
+	}
+};
+
+// FFTW_ESTIMATE, FFTW_MEASURE (default), FFTW_PATIENT or FFTW_EXHAUSTIVE.
+// Wisdom of a higher rigor satisfies all lower ones, so an offline run with
+// FFTW_EXHAUSTIVE makes later FFTW_MEASURE constructions instant.
+void     SetFftwPlanning(unsigned flags);
+unsigned GetFftwPlanning();
+unsigned FindFftwPlanning(const char *name); // "estimate" .. "exhaustive", (unsigned)-1 if unknown
+
+void     SetFftwWisdomDir(const String& dir); // Null disables the cache
+String   GetFftwWisdomDir();
+// ext - FftwOf<Real>::Name(), the wisdom of the precisions is kept apart
+String   GetFftwWisdomPath(int width, int height, int threads, int howmany = 1,
+                           const char *ext = "fftwf");
+
+// in-place forward and backward 2D transforms of a row-major width x height
+// array whose rows are stride cells apart; with howmany > 1, of that many
+// such arrays stored back to back
+void     PlanFftw(int width, int height, int stride, int threads, fftwf_complex *data,
+                  fftwf_plan& fft, fftwf_plan& ifft, int howmany = 1);
+void     PlanFftw(int width, int height, int stride, int threads, fftw_complex *data,
+                  fftw_plan& fft, fftw_plan& ifft, int howmany = 1);
+void     DestroyFftw(fftwf_plan fft, fftwf_plan ifft);
+void     DestroyFftw(fftw_plan fft, fftw_plan ifft);
+
+#endif
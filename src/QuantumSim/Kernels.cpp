@@ -0,0 +1,597 @@
+#include "QuantumSim.h"
+
+#if defined(CPU_X86) && (defined(COMPILER_GCC) || defined(COMPILER_CLANG))
+#define QSIM_SIMD
+#include <immintrin.h>
+#endif
+
+// the scalar code is shared by both precisions, Real (*)[2] being fftwf_complex
+// or fftw_complex
+template <class Real>
+static void ComplexMulScaledScalar(Real (*psi)[2], const Real (*prop)[2], const Real *c, int n) {
+	for (int i = 0; i < n; i++) {
+		double pre = prop[i][0] * (double)c[0] - prop[i][1] * (double)c[1];
+		double pim = prop[i][0] * (double)c[1] + prop[i][1] * (double)c[0];
+		double tre = psi[i][0];
+		double tim = psi[i][1];
+		
+		psi[i][0] = (Real)(tre * pre - tim * pim);
+		psi[i][1] = (Real)(tre * pim + tim * pre);
+	}
+}
+
+template <class Real>
+static double LookupMulNormScalar(Real (*psi)[2], const byte *index, const Real (*lut)[2],
+                                  double quench, int n) {
+	double norm = 0;
+	
+	for (int i = 0; i < n; i++) {
+		double tre = psi[i][0];
+		double tim = psi[i][1];
+		double pre = lut[index[i]][0];
+		double pim = lut[index[i]][1];
+		
+		Real re = (Real)(quench * (tre * pre - tim * pim));
+		Real im = (Real)(quench * (tim * pre + tre * pim));
+		
+		psi[i][0] = re;
+		psi[i][1] = im;
+		
+		norm += (double)re * re + (double)im * im;
+	}
+	
+	return norm;
+}
+
+// w holds a weight per cell, twice, so the SIMD code can apply it to the
+// interleaved (re, im) pairs directly. m gets sum p, sum p w, sum p w^2 and
+// sum p index of p = |psi|^2 after the multiply added.
+template <class Real>
+static void LookupMulMomentsScalar(Real (*psi)[2], const byte *index, const Real (*lut)[2],
+                                   double quench, const float *w, int n, double *m) {
+	for (int i = 0; i < n; i++) {
+		double tre = psi[i][0];
+		double tim = psi[i][1];
+		double pre = lut[index[i]][0];
+		double pim = lut[index[i]][1];
+		
+		Real re = (Real)(quench * (tre * pre - tim * pim));
+		Real im = (Real)(quench * (tim * pre + tre * pim));
+		
+		psi[i][0] = re;
+		psi[i][1] = im;
+		
+		double p = (double)re * re + (double)im * im;
+		double x = w[2 * i];
+		m[0] += p;
+		m[1] += p * x;
+		m[2] += p * x * x;
+		m[3] += p * index[i];
+	}
+}
+
+// the same for psi before the multiply, m gets sum p, sum p w and sum p w^2
+template <class Real>
+static void ComplexMulMomentsScalar(Real (*psi)[2], const Real (*prop)[2], const Real *c,
+                                    const float *w, int n, double *m) {
+	for (int i = 0; i < n; i++) {
+		double p = (double)psi[i][0] * psi[i][0] + (double)psi[i][1] * psi[i][1];
+		double k = w[2 * i];
+		m[0] += p;
+		m[1] += p * k;
+		m[2] += p * k * k;
+	}
+	ComplexMulScaledScalar(psi, prop, c, n);
+}
+
+template <class Real>
+static double NormPrefixScalar(const Real (*psi)[2], double *cdf, int n) {
+	double sum = 0;
+	for (int i = 0; i < n; i++) {
+		sum += (double)psi[i][0] * psi[i][0] + (double)psi[i][1] * psi[i][1];
+		cdf[i] = sum;
+	}
+	return sum;
+}
+
+#ifdef QSIM_SIMD
+
+// All variants work on interleaved (re, im) pairs:
+//   psi * prop = psi * re(prop) -/+ swap(psi) * im(prop)
+// Lookup table entries are fetched as one 64-bit value per cell.
+
+__attribute__((target("sse3")))
+static inline __m128 CMul(__m128 a, __m128 b) {
+	__m128 bre = _mm_moveldup_ps(b);
+	__m128 bim = _mm_movehdup_ps(b);
+	__m128 as = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_addsub_ps(_mm_mul_ps(a, bre), _mm_mul_ps(as, bim));
+}
+
+__attribute__((target("sse3")))
+static void ComplexMulScaledSSE3(fftwf_complex *psi, const fftwf_complex *prop, const float *c, int n) {
+	float *p = (float *)psi;
+	const float *q = (const float *)prop;
+	__m128 cv = _mm_setr_ps(c[0], c[1], c[0], c[1]);
+	int i = 0;
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_ps(p + 2 * i, CMul(_mm_loadu_ps(p + 2 * i), CMul(_mm_loadu_ps(q + 2 * i), cv)));
+	ComplexMulScaledScalar(psi + i, prop + i, c, n - i);
+}
+
+__attribute__((target("sse3")))
+static double LookupMulNormSSE3(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                                double quench, int n) {
+	float *p = (float *)psi;
+	__m128 qv = _mm_set1_ps((float)quench);
+	__m128d acc0 = _mm_setzero_pd();
+	__m128d acc1 = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128 g = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)lut[index[i]]),
+		                        (const __m64 *)lut[index[i + 1]]);
+		__m128 r = _mm_mul_ps(qv, CMul(_mm_loadu_ps(p + 2 * i), g));
+		_mm_storeu_ps(p + 2 * i, r);
+		__m128 r2 = _mm_mul_ps(r, r);
+		acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(r2));
+		acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(r2, r2)));
+	}
+	double a[2];
+	_mm_storeu_pd(a, _mm_add_pd(acc0, acc1));
+	return a[0] + a[1] + LookupMulNormScalar(psi + i, index + i, lut, quench, n - i);
+}
+
+// the moments are summed per pair of floats and converted to double first
+__attribute__((target("sse3")))
+static inline void AddPd(__m128d *acc, __m128 v) {
+	acc[0] = _mm_add_pd(acc[0], _mm_cvtps_pd(v));
+	acc[1] = _mm_add_pd(acc[1], _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+}
+
+__attribute__((target("sse3")))
+static double SumPd(const __m128d *acc) {
+	double a[2];
+	_mm_storeu_pd(a, _mm_add_pd(acc[0], acc[1]));
+	return a[0] + a[1];
+}
+
+__attribute__((target("sse3")))
+static void LookupMulMomentsSSE3(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                                 double quench, const float *w, int n, double *m) {
+	float *p = (float *)psi;
+	__m128 qv = _mm_set1_ps((float)quench);
+	__m128d acc[4][2];
+	for (int j = 0; j < 4; j++)
+		acc[j][0] = acc[j][1] = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128 g = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)lut[index[i]]),
+		                        (const __m64 *)lut[index[i + 1]]);
+		__m128 r = _mm_mul_ps(qv, CMul(_mm_loadu_ps(p + 2 * i), g));
+		_mm_storeu_ps(p + 2 * i, r);
+		__m128 r2 = _mm_mul_ps(r, r);
+		__m128 wv = _mm_loadu_ps(w + 2 * i);
+		__m128 r2w = _mm_mul_ps(r2, wv);
+		__m128 vv = _mm_setr_ps(index[i], index[i], index[i + 1], index[i + 1]);
+		AddPd(acc[0], r2);
+		AddPd(acc[1], r2w);
+		AddPd(acc[2], _mm_mul_ps(r2w, wv));
+		AddPd(acc[3], _mm_mul_ps(r2, vv));
+	}
+	for (int j = 0; j < 4; j++)
+		m[j] += SumPd(acc[j]);
+	LookupMulMomentsScalar(psi + i, index + i, lut, quench, w + 2 * i, n - i, m);
+}
+
+__attribute__((target("sse3")))
+static void ComplexMulMomentsSSE3(fftwf_complex *psi, const fftwf_complex *prop, const float *c,
+                                  const float *w, int n, double *m) {
+	float *p = (float *)psi;
+	const float *q = (const float *)prop;
+	__m128 cv = _mm_setr_ps(c[0], c[1], c[0], c[1]);
+	__m128d acc[3][2];
+	for (int j = 0; j < 3; j++)
+		acc[j][0] = acc[j][1] = _mm_setzero_pd();
+	int i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128 a = _mm_loadu_ps(p + 2 * i);
+		__m128 a2 = _mm_mul_ps(a, a);
+		__m128 wv = _mm_loadu_ps(w + 2 * i);
+		__m128 a2w = _mm_mul_ps(a2, wv);
+		AddPd(acc[0], a2);
+		AddPd(acc[1], a2w);
+		AddPd(acc[2], _mm_mul_ps(a2w, wv));
+		_mm_storeu_ps(p + 2 * i, CMul(a, CMul(_mm_loadu_ps(q + 2 * i), cv)));
+	}
+	for (int j = 0; j < 3; j++)
+		m[j] += SumPd(acc[j]);
+	ComplexMulMomentsScalar(psi + i, prop + i, c, w + 2 * i, n - i, m);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 CMul(__m256 a, __m256 b) {
+	__m256 bre = _mm256_moveldup_ps(b);
+	__m256 bim = _mm256_movehdup_ps(b);
+	__m256 as = _mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm256_fmaddsub_ps(a, bre, _mm256_mul_ps(as, bim));
+}
+
+__attribute__((target("avx2,fma")))
+static void ComplexMulScaledAVX2(fftwf_complex *psi, const fftwf_complex *prop, const float *c, int n) {
+	float *p = (float *)psi;
+	const float *q = (const float *)prop;
+	__m256 cv = _mm256_setr_ps(c[0], c[1], c[0], c[1], c[0], c[1], c[0], c[1]);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm256_storeu_ps(p + 2 * i, CMul(_mm256_loadu_ps(p + 2 * i), CMul(_mm256_loadu_ps(q + 2 * i), cv)));
+	_mm256_zeroupper();
+	ComplexMulScaledScalar(psi + i, prop + i, c, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+static double LookupMulNormAVX2(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                                double quench, int n) {
+	float *p = (float *)psi;
+	__m256 qv = _mm256_set1_ps((float)quench);
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		int32 quad;
+		memcpy(&quad, index + i, 4);
+		__m128i idx = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad));
+		__m256 g = _mm256_castpd_ps(_mm256_i32gather_pd((const double *)lut, idx, 8));
+		__m256 r = _mm256_mul_ps(qv, CMul(_mm256_loadu_ps(p + 2 * i), g));
+		_mm256_storeu_ps(p + 2 * i, r);
+		__m256 r2 = _mm256_mul_ps(r, r);
+		acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(r2)));
+		acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(r2, 1)));
+	}
+	double a[4];
+	_mm256_storeu_pd(a, _mm256_add_pd(acc0, acc1));
+	_mm256_zeroupper();
+	return a[0] + a[1] + a[2] + a[3] + LookupMulNormScalar(psi + i, index + i, lut, quench, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+static inline void AddPd(__m256d *acc, __m256 v) {
+	acc[0] = _mm256_add_pd(acc[0], _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+	acc[1] = _mm256_add_pd(acc[1], _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+}
+
+__attribute__((target("avx2,fma")))
+static double SumPd(const __m256d *acc) {
+	double a[4];
+	_mm256_storeu_pd(a, _mm256_add_pd(acc[0], acc[1]));
+	return a[0] + a[1] + a[2] + a[3];
+}
+
+__attribute__((target("avx2,fma")))
+static void LookupMulMomentsAVX2(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                                 double quench, const float *w, int n, double *m) {
+	float *p = (float *)psi;
+	__m256 qv = _mm256_set1_ps((float)quench);
+	__m256i dup = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+	__m256d acc[4][2];
+	for (int j = 0; j < 4; j++)
+		acc[j][0] = acc[j][1] = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		int32 quad;
+		memcpy(&quad, index + i, 4);
+		__m128i idx = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(quad));
+		__m256 g = _mm256_castpd_ps(_mm256_i32gather_pd((const double *)lut, idx, 8));
+		__m256 r = _mm256_mul_ps(qv, CMul(_mm256_loadu_ps(p + 2 * i), g));
+		_mm256_storeu_ps(p + 2 * i, r);
+		__m256 r2 = _mm256_mul_ps(r, r);
+		__m256 wv = _mm256_loadu_ps(w + 2 * i);
+		__m256 r2w = _mm256_mul_ps(r2, wv);
+		__m256 vv = _mm256_cvtepi32_ps(_mm256_permutevar8x32_epi32(_mm256_castsi128_si256(idx), dup));
+		AddPd(acc[0], r2);
+		AddPd(acc[1], r2w);
+		AddPd(acc[2], _mm256_mul_ps(r2w, wv));
+		AddPd(acc[3], _mm256_mul_ps(r2, vv));
+	}
+	for (int j = 0; j < 4; j++)
+		m[j] += SumPd(acc[j]);
+	_mm256_zeroupper();
+	LookupMulMomentsScalar(psi + i, index + i, lut, quench, w + 2 * i, n - i, m);
+}
+
+__attribute__((target("avx2,fma")))
+static void ComplexMulMomentsAVX2(fftwf_complex *psi, const fftwf_complex *prop, const float *c,
+                                  const float *w, int n, double *m) {
+	float *p = (float *)psi;
+	const float *q = (const float *)prop;
+	__m256 cv = _mm256_setr_ps(c[0], c[1], c[0], c[1], c[0], c[1], c[0], c[1]);
+	__m256d acc[3][2];
+	for (int j = 0; j < 3; j++)
+		acc[j][0] = acc[j][1] = _mm256_setzero_pd();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256 a = _mm256_loadu_ps(p + 2 * i);
+		__m256 a2 = _mm256_mul_ps(a, a);
+		__m256 wv = _mm256_loadu_ps(w + 2 * i);
+		__m256 a2w = _mm256_mul_ps(a2, wv);
+		AddPd(acc[0], a2);
+		AddPd(acc[1], a2w);
+		AddPd(acc[2], _mm256_mul_ps(a2w, wv));
+		_mm256_storeu_ps(p + 2 * i, CMul(a, CMul(_mm256_loadu_ps(q + 2 * i), cv)));
+	}
+	for (int j = 0; j < 3; j++)
+		m[j] += SumPd(acc[j]);
+	_mm256_zeroupper();
+	ComplexMulMomentsScalar(psi + i, prop + i, c, w + 2 * i, n - i, m);
+}
+
+// the running sum of 4 cells at a time: |psi|^2 in double, then a prefix sum
+// across the register in two shift-and-add steps
+__attribute__((target("avx2,fma")))
+static double NormPrefixAVX2(const fftwf_complex *psi, double *cdf, int n) {
+	const float *p = (const float *)psi;
+	__m256d zero = _mm256_setzero_pd();
+	__m256d carry = zero;
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256 v = _mm256_loadu_ps(p + 2 * i);
+		__m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+		__m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+		// [c0, c2, c1, c3] -> [c0, c1, c2, c3]
+		__m256d x = _mm256_hadd_pd(_mm256_mul_pd(lo, lo), _mm256_mul_pd(hi, hi));
+		x = _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 1, 2, 0));
+		x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, _MM_SHUFFLE(2, 1, 0, 0)), zero, 1));
+		x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, _MM_SHUFFLE(1, 0, 0, 0)), zero, 3));
+		x = _mm256_add_pd(x, carry);
+		_mm256_storeu_pd(cdf + i, x);
+		carry = _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	double sum = _mm256_cvtsd_f64(carry);
+	_mm256_zeroupper();
+	for (; i < n; i++) {
+		sum += (double)psi[i][0] * psi[i][0] + (double)psi[i][1] * psi[i][1];
+		cdf[i] = sum;
+	}
+	return sum;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 CMul(__m512 a, __m512 b) {
+	__m512 bre = _mm512_moveldup_ps(b);
+	__m512 bim = _mm512_movehdup_ps(b);
+	__m512 as = _mm512_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm512_fmaddsub_ps(a, bre, _mm512_mul_ps(as, bim));
+}
+
+__attribute__((target("avx512f")))
+static void ComplexMulScaledAVX512(fftwf_complex *psi, const fftwf_complex *prop, const float *c, int n) {
+	float *p = (float *)psi;
+	const float *q = (const float *)prop;
+	double pair;
+	memcpy(&pair, c, sizeof(pair));
+	__m512 cv = _mm512_castpd_ps(_mm512_set1_pd(pair));
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm512_storeu_ps(p + 2 * i, CMul(_mm512_loadu_ps(p + 2 * i), CMul(_mm512_loadu_ps(q + 2 * i), cv)));
+	_mm256_zeroupper();
+	ComplexMulScaledScalar(psi + i, prop + i, c, n - i);
+}
+
+__attribute__((target("avx512f")))
+static double LookupMulNormAVX512(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                                  double quench, int n) {
+	float *p = (float *)psi;
+	__m512 qv = _mm512_set1_ps((float)quench);
+	__m512d acc0 = _mm512_setzero_pd();
+	__m512d acc1 = _mm512_setzero_pd();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(index + i)));
+		__m512 g = _mm512_castpd_ps(_mm512_i32gather_pd(idx, (const double *)lut, 8));
+		__m512 r = _mm512_mul_ps(qv, CMul(_mm512_loadu_ps(p + 2 * i), g));
+		_mm512_storeu_ps(p + 2 * i, r);
+		__m512 r2 = _mm512_mul_ps(r, r);
+		acc0 = _mm512_add_pd(acc0, _mm512_cvtps_pd(_mm512_castps512_ps256(r2)));
+		acc1 = _mm512_add_pd(acc1, _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(r2), 1))));
+	}
+	double sum = _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+	_mm256_zeroupper();
+	return sum + LookupMulNormScalar(psi + i, index + i, lut, quench, n - i);
+}
+
+__attribute__((target("avx512f")))
+static inline void AddPd(__m512d *acc, __m512 v) {
+	acc[0] = _mm512_add_pd(acc[0], _mm512_cvtps_pd(_mm512_castps512_ps256(v)));
+	acc[1] = _mm512_add_pd(acc[1], _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1))));
+}
+
+__attribute__((target("avx512f")))
+static void LookupMulMomentsAVX512(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                                   double quench, const float *w, int n, double *m) {
+	float *p = (float *)psi;
+	__m512 qv = _mm512_set1_ps((float)quench);
+	__m512i dup = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+	__m512d acc[4][2];
+	for (int j = 0; j < 4; j++)
+		acc[j][0] = acc[j][1] = _mm512_setzero_pd();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(index + i)));
+		__m512 g = _mm512_castpd_ps(_mm512_i32gather_pd(idx, (const double *)lut, 8));
+		__m512 r = _mm512_mul_ps(qv, CMul(_mm512_loadu_ps(p + 2 * i), g));
+		_mm512_storeu_ps(p + 2 * i, r);
+		__m512 r2 = _mm512_mul_ps(r, r);
+		__m512 wv = _mm512_loadu_ps(w + 2 * i);
+		__m512 r2w = _mm512_mul_ps(r2, wv);
+		__m512 vv = _mm512_cvtepi32_ps(_mm512_permutexvar_epi32(dup, _mm512_castsi256_si512(idx)));
+		AddPd(acc[0], r2);
+		AddPd(acc[1], r2w);
+		AddPd(acc[2], _mm512_mul_ps(r2w, wv));
+		AddPd(acc[3], _mm512_mul_ps(r2, vv));
+	}
+	for (int j = 0; j < 4; j++)
+		m[j] += _mm512_reduce_add_pd(_mm512_add_pd(acc[j][0], acc[j][1]));
+	_mm256_zeroupper();
+	LookupMulMomentsScalar(psi + i, index + i, lut, quench, w + 2 * i, n - i, m);
+}
+
+__attribute__((target("avx512f")))
+static void ComplexMulMomentsAVX512(fftwf_complex *psi, const fftwf_complex *prop, const float *c,
+                                    const float *w, int n, double *m) {
+	float *p = (float *)psi;
+	const float *q = (const float *)prop;
+	double pair;
+	memcpy(&pair, c, sizeof(pair));
+	__m512 cv = _mm512_castpd_ps(_mm512_set1_pd(pair));
+	__m512d acc[3][2];
+	for (int j = 0; j < 3; j++)
+		acc[j][0] = acc[j][1] = _mm512_setzero_pd();
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m512 a = _mm512_loadu_ps(p + 2 * i);
+		__m512 a2 = _mm512_mul_ps(a, a);
+		__m512 wv = _mm512_loadu_ps(w + 2 * i);
+		__m512 a2w = _mm512_mul_ps(a2, wv);
+		AddPd(acc[0], a2);
+		AddPd(acc[1], a2w);
+		AddPd(acc[2], _mm512_mul_ps(a2w, wv));
+		_mm512_storeu_ps(p + 2 * i, CMul(a, CMul(_mm512_loadu_ps(q + 2 * i), cv)));
+	}
+	for (int j = 0; j < 3; j++)
+		m[j] += _mm512_reduce_add_pd(_mm512_add_pd(acc[j][0], acc[j][1]));
+	_mm256_zeroupper();
+	ComplexMulMomentsScalar(psi + i, prop + i, c, w + 2 * i, n - i, m);
+}
+
+#endif
+
+static bool IsKernelSupported(int kernel) {
+	switch (kernel) {
+	case KERNEL_SCALAR:
+		return true;
+#ifdef QSIM_SIMD
+	case KERNEL_SSE3:
+		return __builtin_cpu_supports("sse3");
+	case KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case KERNEL_AVX512:
+		return __builtin_cpu_supports("avx512f");
+#endif
+	}
+	return false;
+}
+
+static int BestKernel() {
+	for (int k = KERNEL_COUNT - 1; k > KERNEL_SCALAR; k--)
+		if (IsKernelSupported(k))
+			return k;
+	return KERNEL_SCALAR;
+}
+
+static int  s_kernel = BestKernel();
+
+bool SetSplitStepKernel(int kernel) {
+	if (kernel == KERNEL_AUTO)
+		kernel = BestKernel();
+	if (kernel <= KERNEL_AUTO || kernel >= KERNEL_COUNT || !IsKernelSupported(kernel))
+		return false;
+	s_kernel = kernel;
+	return true;
+}
+
+int GetSplitStepKernel() {
+	return s_kernel;
+}
+
+const char *GetSplitStepKernelName(int kernel) {
+	static const char *name[] = {"auto", "scalar", "sse3", "avx2", "avx512"};
+	return kernel >= 0 && kernel < KERNEL_COUNT ? name[kernel] : "?";
+}
+
+int FindSplitStepKernel(const char *name) {
+	for (int k = 0; k < KERNEL_COUNT; k++)
+		if (strcmp(name, GetSplitStepKernelName(k)) == 0)
+			return k;
+	return -1;
+}
+
+void ComplexMulScaled(fftwf_complex *psi, const fftwf_complex *prop, const float *c, int n) {
+	switch (s_kernel) {
+#ifdef QSIM_SIMD
+	case KERNEL_SSE3:   ComplexMulScaledSSE3(psi, prop, c, n); return;
+	case KERNEL_AVX2:   ComplexMulScaledAVX2(psi, prop, c, n); return;
+	case KERNEL_AVX512: ComplexMulScaledAVX512(psi, prop, c, n); return;
+#endif
+	default:            ComplexMulScaledScalar(psi, prop, c, n); return;
+	}
+}
+
+double NormPrefix(const fftwf_complex *psi, double *cdf, int n) {
+	switch (s_kernel) {
+#ifdef QSIM_SIMD
+	// the scan is bound by the dependency between the partial sums, so the
+	// AVX2 code serves AVX-512 too; SSE3 gains nothing over scalar code
+	case KERNEL_AVX2:
+	case KERNEL_AVX512: return NormPrefixAVX2(psi, cdf, n);
+#endif
+	default:            return NormPrefixScalar(psi, cdf, n);
+	}
+}
+
+double LookupMulNorm(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                     double quench, int n) {
+	switch (s_kernel) {
+#ifdef QSIM_SIMD
+	case KERNEL_SSE3:   return LookupMulNormSSE3(psi, index, lut, quench, n);
+	case KERNEL_AVX2:   return LookupMulNormAVX2(psi, index, lut, quench, n);
+	case KERNEL_AVX512: return LookupMulNormAVX512(psi, index, lut, quench, n);
+#endif
+	default:            return LookupMulNormScalar(psi, index, lut, quench, n);
+	}
+}
+
+void LookupMulMoments(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                      double quench, const float *w, int n, double *m) {
+	switch (s_kernel) {
+#ifdef QSIM_SIMD
+	case KERNEL_SSE3:   LookupMulMomentsSSE3(psi, index, lut, quench, w, n, m); return;
+	case KERNEL_AVX2:   LookupMulMomentsAVX2(psi, index, lut, quench, w, n, m); return;
+	case KERNEL_AVX512: LookupMulMomentsAVX512(psi, index, lut, quench, w, n, m); return;
+#endif
+	default:            LookupMulMomentsScalar(psi, index, lut, quench, w, n, m); return;
+	}
+}
+
+void ComplexMulMoments(fftwf_complex *psi, const fftwf_complex *prop, const float *c,
+                       const float *w, int n, double *m) {
+	switch (s_kernel) {
+#ifdef QSIM_SIMD
+	case KERNEL_SSE3:   ComplexMulMomentsSSE3(psi, prop, c, w, n, m); return;
+	case KERNEL_AVX2:   ComplexMulMomentsAVX2(psi, prop, c, w, n, m); return;
+	case KERNEL_AVX512: ComplexMulMomentsAVX512(psi, prop, c, w, n, m); return;
+#endif
+	default:            ComplexMulMomentsScalar(psi, prop, c, w, n, m); return;
+	}
+}
+
+void ComplexMulScaled(fftw_complex *psi, const fftw_complex *prop, const double *c, int n) {
+	ComplexMulScaledScalar(psi, prop, c, n);
+}
+
+double LookupMulNorm(fftw_complex *psi, const byte *index, const fftw_complex *lut,
+                     double quench, int n) {
+	return LookupMulNormScalar(psi, index, lut, quench, n);
+}
+
+double NormPrefix(const fftw_complex *psi, double *cdf, int n) {
+	return NormPrefixScalar(psi, cdf, n);
+}
+
+void LookupMulMoments(fftw_complex *psi, const byte *index, const fftw_complex *lut,
+                      double quench, const float *w, int n, double *m) {
+	LookupMulMomentsScalar(psi, index, lut, quench, w, n, m);
+}
+
+void ComplexMulMoments(fftw_complex *psi, const fftw_complex *prop, const double *c,
+                       const float *w, int n, double *m) {
+	ComplexMulMomentsScalar(psi, prop, c, w, n, m);
+}
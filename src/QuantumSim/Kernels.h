@@ -0,0 +1,87 @@
+#ifndef _QuantumSim_Kernels_h_
+#define _QuantumSim_Kernels_h_
+
+// Pointwise kernels of the split-step scheme. Each one streams through psi
+// once; the instruction set (SSE3, AVX2+FMA, AVX-512) is picked at runtime.
+//
+// The SIMD paths multiply in single precision, while the scalar path keeps
+// double precision temporaries. Tolerance: after 1000 steps of the doubleslit track at
+// 640x320 the SIMD results differ from the scalar ones by a relative L2 error
+// below 1e-4 in psi and 1e-6 in the norm. This is the same size as the
+// difference between two runs of the scalar code with different FFTW_MEASURE
+// plans, and far below the 8-bit resolution of the display.
+
+enum {
+	KERNEL_AUTO,
+	KERNEL_SCALAR,
+	KERNEL_SSE3,
+	KERNEL_AVX2,
+	KERNEL_AVX512,
+	KERNEL_COUNT
+};
+
+bool        SetSplitStepKernel(int kernel); // false if the CPU lacks the instruction set
+int         GetSplitStepKernel();
+const char *GetSplitStepKernelName(int kernel);
+int         FindSplitStepKernel(const char *name);
+
+// psi[i] *= prop[i] * c, applies one row of a separable propagator
+void   ComplexMulScaled(fftwf_complex *psi, const fftwf_complex *prop, const float *c, int n);
+
+// psi[i] = quench * psi[i] * lut[index[i]], returns the sum of |psi[i]|^2 afterwards
+double LookupMulNorm(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                     double quench, int n);
+
+// cdf[i] = sum of |psi[j]|^2 for j <= i, in double; returns the total
+double NormPrefix(const fftwf_complex *psi, double *cdf, int n);
+
+// the same kernels, also summing moments of p = |psi[i]|^2 into m for the
+// observables, see QuantumSimulator::SetObservables. w holds a weight per
+// cell, each one twice in a row (w[2 i] = w[2 i + 1]).
+// LookupMulMoments adds sum p, sum p w, sum p w^2 and sum p index[i] of psi
+// afterwards to m[0 .. 3]; ComplexMulMoments adds sum p, sum p w and sum p w^2
+// of psi before the multiply to m[0 .. 2].
+void   LookupMulMoments(fftwf_complex *psi, const byte *index, const fftwf_complex *lut,
+                        double quench, const float *w, int n, double *m);
+void   ComplexMulMoments(fftwf_complex *psi, const fftwf_complex *prop, const float *c,
+                         const float *w, int n, double *m);
+
+// the same in double precision, for validation runs; scalar code only
+void   ComplexMulScaled(fftw_complex *psi, const fftw_complex *prop, const double *c, int n);
+double LookupMulNorm(fftw_complex *psi, const byte *index, const fftw_complex *lut,
+                     double quench, int n);
+double NormPrefix(const fftw_complex *psi, double *cdf, int n);
+void   LookupMulMoments(fftw_complex *psi, const byte *index, const fftw_complex *lut,
+                        double quench, const float *w, int n, double *m);
+void   ComplexMulMoments(fftw_complex *psi, const fftw_complex *prop, const double *c,
+                         const float *w, int n, double *m);
+
+enum { KERNEL_CHUNK = 16384 }; // cells per work item of the pointwise loops
+
+// ForChunks - call fn(chunk, begin, end) for the chunks of [0, n) with size
+// items each, using up to threads workers. The chunking does not depend on
+// the thread count, so per-chunk results can be combined in a deterministic order.
+template <class F>
+inline void ForChunks(int n, int size, int threads, F fn) {
+	int nchunks = (n + size - 1) / size;
+	
+	if (threads <= 1 || nchunks <= 1) {
+		for (int i = 0; i < nchunks; i++)
+			fn(i, i * size, min(n, (i + 1) * size));
+		return;
+	}
+	
+	Atomic next(0);
+	auto worker = [&] {
+		for (int i = next++; i < nchunks; i = next++)
+			fn(i, i * size, min(n, (i + 1) * size));
+	};
+	
+	CoWork co;
+	for (int i = 1; i < min(threads, nchunks); i++)
+		co & worker;
+	worker();
+	co.Finish();
+}
+
+#endif
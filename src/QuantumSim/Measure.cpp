@@ -0,0 +1,82 @@
+#include "QuantumSim.h"
+
+const char *GetMeasureRuleName(int rule) {
+	static const char *name[] = {"born", "classic"};
+	return rule >= 0 && rule < MEASURE_RULES ? name[rule] : "?";
+}
+
+int FindMeasureRule(const char *name) {
+	for (int r = 0; r < MEASURE_RULES; r++)
+		if (strcmp(name, GetMeasureRuleName(r)) == 0)
+			return r;
+	return -1;
+}
+
+template <class Real>
+void PositionSampler::Build(const QuantumSimulator_<Real>& sim, int rule) {
+	if (sim.GetWidth() != width || sim.GetHeight() != height) {
+		width = sim.GetWidth();
+		height = sim.GetHeight();
+		cdf.Alloc(width * height);
+		rowcdf.Alloc(height);
+	}
+	
+	double sum = 0;
+	if (rule != MEASURE_CLASSIC) {
+		for (int y = 0; y < height; y++) {
+			sum += NormPrefix(&sim.Psi(0, y), ~cdf + y * width, width);
+			rowcdf[y] = sum;
+		}
+		return;
+	}
+	
+	// the acceptance test of the old rejection sampler, as weights
+	double norm4 = 0;
+	for (int y = 0; y < height; y++)
+		for (int x = 0; x < width; x++) {
+			const Real *p = sim.Psi(x, y);
+			double psi2 = (double)p[0] * p[0] + (double)p[1] * p[1];
+			norm4 += psi2 * psi2;
+		}
+	double scale = norm4 > 0 ? .5 / norm4 : 0;
+	
+	for (int y = 0; y < height; y++) {
+		double *row = ~cdf + y * width;
+		double s = 0;
+		for (int x = 0; x < width; x++) {
+			const Real *p = sim.Psi(x, y);
+			double psi2 = (double)p[0] * p[0] + (double)p[1] * p[1];
+			s += minmax(psi2 * psi2 * scale - 1e-6, 0.0, 1.0);
+			row[x] = s;
+		}
+		sum += s;
+		rowcdf[y] = sum;
+	}
+}
+
+template void PositionSampler::Build(const QuantumSimulator& sim, int rule);
+template void PositionSampler::Build(const QuantumSimulator64& sim, int rule);
+
+Point PositionSampler::Sample(Rng& rng) const {
+	double total = GetTotal();
+	if (total <= 0)
+		return Null;
+	
+	double u = rng.GetDouble() * total;
+	
+	// the first row whose running sum exceeds u; rows without probability are
+	// never chosen, as their running sum equals the one before
+	int y = int(std::upper_bound(~rowcdf, ~rowcdf + height, u) - ~rowcdf);
+	if (y >= height)
+		y = int(std::lower_bound(~rowcdf, ~rowcdf + height, total) - ~rowcdf);
+	
+	const double *row = ~cdf + y * width;
+	double rowsum = row[width - 1];
+	double v = u - (y > 0 ? rowcdf[y - 1] : 0);
+	
+	int x = int(std::upper_bound(row, row + width, v) - row);
+	if (x >= width)
+		x = int(std::lower_bound(row, row + width, rowsum) - row);
+	
+	return Point(x, y);
+}
@@ -0,0 +1,38 @@
+#ifndef _QuantumSim_Measure_h_
+#define _QuantumSim_Measure_h_
+
+// measurement rules, how likely a cell is to be measured
+enum {
+	MEASURE_BORN,    // |psi|^2
+	MEASURE_CLASSIC, // the rule the game was tuned with: |psi|^4 / (2 sum |psi|^4) - 1e-6,
+	                 // at least 0. Favors the peaks of the wave, the faint parts never win.
+	MEASURE_RULES
+};
+
+const char *GetMeasureRuleName(int rule);
+int         FindMeasureRule(const char *name); // -1 if unknown
+
+// PositionSampler - draws measured positions from the weights of a rule.
+// Build() makes one or two passes over psi and stores the cumulative weight of
+// each row and within each row; every Sample() is then two binary searches,
+// O(log N), no matter how far the wave has spread.
+class PositionSampler {
+	int width, height;
+	Buffer<double> cdf;    // running sum of the weights within each row
+	Buffer<double> rowcdf; // running sum of the row totals
+	
+public:
+	template <class Real>
+	void   Build(const QuantumSimulator_<Real>& sim, int rule = MEASURE_BORN);
+	
+	// Sample - grid coordinates of a random position, Null if psi is zero
+	Point  Sample(Rng& rng) const;
+	
+	// GetTotal - sum of the weights over the grid, for MEASURE_BORN |psi|^2 in
+	// the units of psi
+	double GetTotal() const {return height > 0 ? rowcdf[height - 1] : 0;}
+	
+	PositionSampler() {width = height = 0;}
+};
+
+#endif
@@ -0,0 +1,142 @@
+#include "QuantumSim.h"
+
+#include <plugin/png/png.h>
+
+const char *GetMovieStyleName(int style) {
+	static const char *name[] = {"plain", "color", "saturated", "inverted", "uncertainty"};
+	return style >= 0 && style < MOVIE_STYLES ? name[style] : "?";
+}
+
+int FindMovieStyle(const char *name) {
+	for (int s = 0; s < MOVIE_STYLES; s++)
+		if (strcmp(name, GetMovieStyleName(s)) == 0)
+			return s;
+	return -1;
+}
+
+const Image& GetMovieColormap(int style) {
+	return GetWaveColormap(style == MOVIE_PLAIN);
+}
+
+int GetMovieWaveMode(int style) {
+	return style == MOVIE_SATURATED ? WAVE_SATURATE :
+	       style == MOVIE_INVERTED ? WAVE_INVERT : WAVE_ADD;
+}
+
+bool IsMoviePositionFirst(int style) {
+	return style == MOVIE_INVERTED;
+}
+
+MovieRenderer::MovieRenderer() {
+	open = failed = false;
+	committed = written = 0;
+	format = MOVIE_PNG;
+	cmap = NULL;
+	mode = WAVE_ADD;
+}
+
+bool MovieRenderer::Open(const char *path, int format, const Track& track, Size grid, int style) {
+	Close();
+	if (grid.cx <= 0 || grid.cy <= 0 || style < 0 || style >= MOVIE_STYLES)
+		return false;
+	
+	if (format == MOVIE_PNG ? !RealizeDirectory(path) : !out.Open(path))
+		return false;
+	
+	this->path = path;
+	this->format = format;
+	this->grid = grid;
+	size = Size(FIELD_WIDTH, FIELD_HEIGHT);
+	background = RenderTrackBackground(track, grid);
+	cmap = &GetMovieColormap(style);
+	mode = GetMovieWaveMode(style);
+	
+	slot.Clear();
+	slot.SetCount(2 * CPU_Cores());
+	for (int i = 0; i < slot.GetCount(); i++) {
+		slot[i].done = false;
+		vacant.Release();
+	}
+	
+	committed = written = 0;
+	failed = false;
+	open = true;
+	return true;
+}
+
+PsiFrame& MovieRenderer::Claim() {
+	vacant.Wait();
+	return slot[committed % slot.GetCount()].frame;
+}
+
+void MovieRenderer::Commit() {
+	int i;
+	{
+		Mutex::Lock __(lock);
+		i = committed++;
+	}
+	co & [=] {Render(i);};
+}
+
+// Render - frame i, then write the frames that are done in order
+void MovieRenderer::Render(int i) {
+	Slot& s = slot[i % slot.GetCount()];
+	
+	ImageBuffer ib(grid);
+	if (s.frame.width == grid.cx && s.frame.height == grid.cy)
+		RenderWave(ib.Begin(), background.Begin(), s.frame, *cmap, mode);
+	else
+		memcpy(ib.Begin(), background.Begin(), grid.cx * grid.cy * sizeof(RGBA));
+	ib.SetKind(IMAGE_OPAQUE);
+	Image img = ib;
+	if (grid != size)
+		img = Rescale(img, size);
+	
+	if (format == MOVIE_PNG)
+		s.data = PNGEncoder().SaveString(img);
+	else {
+		StringBuffer b(3 * size.cx * size.cy);
+		byte *t = (byte *)~b;
+		for (const RGBA *p = img.Begin(); p < img.End(); p++) {
+			*t++ = p->r;
+			*t++ = p->g;
+			*t++ = p->b;
+		}
+		s.data = b;
+	}
+	
+	Mutex::Lock __(lock);
+	s.done = true;
+	for (;;) {
+		Slot& w = slot[written % slot.GetCount()];
+		if (written == committed || !w.done)
+			break;
+		if (!failed) {
+			if (format == MOVIE_PNG)
+				failed = !SaveFile(AppendFileName(path, Format("frame%05d.png", written)), w.data);
+			else {
+				out.Put(w.data);
+				failed = out.IsError();
+			}
+		}
+		w.data.Clear();
+		w.done = false;
+		written++;
+		vacant.Release();
+	}
+}
+
+bool MovieRenderer::Close() {
+	if (!open)
+		return !failed;
+	co.Finish();
+	// all slots are vacant again, Open releases them anew
+	for (int i = 0; i < slot.GetCount(); i++)
+		vacant.Wait();
+	if (format == MOVIE_RAW) {
+		out.Close();
+		failed = failed || out.IsError();
+	}
+	open = false;
+	return !failed;
+}
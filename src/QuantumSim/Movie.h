@@ -0,0 +1,80 @@
+#ifndef _QuantumSim_Movie_h_
+#define _QuantumSim_Movie_h_
+
+// Movies - the frames of a run painted the way the game paints the moving
+// wave, without a display, e.g. for demo videos.
+
+// the looks of the wave, after the hack states of the game
+enum {
+	MOVIE_PLAIN,       // the monochrome colormap
+	MOVIE_COLOR,       // the phase in color
+	MOVIE_SATURATED,   // WAVE_SATURATE
+	MOVIE_INVERTED,    // WAVE_INVERT, stepped in position space first
+	MOVIE_UNCERTAINTY, // in color, FireUncertainty instead of the shot
+	MOVIE_STYLES
+};
+
+const char  *GetMovieStyleName(int style);
+int          FindMovieStyle(const char *name); // -1 if unknown
+const Image& GetMovieColormap(int style);
+int          GetMovieWaveMode(int style);      // WAVE_ADD ..
+bool         IsMoviePositionFirst(int style);  // the argument of QuantumSimulator::Step
+
+enum {
+	MOVIE_PNG, // frame00000.png, frame00001.png .. in a directory
+	MOVIE_RAW, // one stream of 8-bit RGB frames, rows first, e.g. for ffmpeg -f rawvideo
+};
+
+// MovieRenderer - renders and encodes frames on all cores while the producer,
+// e.g. the thread stepping the simulator, makes the next ones. The frames are
+// written in order. At most 2 frames per core are in flight; Claim waits
+// while they all are. Claim, Commit and Close are called by the producer.
+class MovieRenderer : NoCopy {
+public:
+	// Open - render frames of a grid of size grid over track in style, scaled
+	// to the field size, into path
+	bool      Open(const char *path, int format, const Track& track, Size grid, int style);
+	bool      IsOpen() const {return open;}
+	
+	// Claim - the frame to fill next; Commit hands it over for rendering,
+	// Cancel gives it back unused. One of them must follow every Claim.
+	PsiFrame& Claim();
+	void      Commit();
+	void      Cancel() {vacant.Release();}
+	// Close - wait for the frames in flight. false if writing failed.
+	bool      Close();
+	
+	int       GetFrames() const    {return written;}
+	Size      GetFrameSize() const {return size;}
+	
+	MovieRenderer();
+	~MovieRenderer() {Close();}
+
+private:
+	struct Slot {
+		PsiFrame frame;
+		String   data;  // the frame encoded, until it is written
+		bool     done;
+	};
+	
+	Array<Slot> slot;      // frame i is rendered in slot i % count
+	Semaphore   vacant;    // released for each slot written
+	CoWork      co;
+	Mutex       lock;      // of the done flags, written, failed and out
+	bool        open;
+	bool        failed;
+	int         committed; // frames handed over
+	int         written;   // frames written
+	
+	String      path;
+	int         format;
+	FileOut     out;
+	Image       background;
+	const Image *cmap;
+	int         mode;
+	Size        grid, size;
+	
+	void Render(int i);
+};
+
+#endif
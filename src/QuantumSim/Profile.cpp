@@ -0,0 +1,202 @@
+#include "QuantumSim.h"
+
+#ifdef flagPROFILE
+
+#include <chrono>
+
+// ProfilePhase - the durations of one phase. Any thread may add to it; the
+// ring of the last durations is written without locks, so a reader may see
+// a duration of the previous round of the ring for a slot being written.
+struct ProfilePhase {
+	const char          *name;
+	int                  id;
+	std::atomic<int64>   calls;
+	std::atomic<int64>   ns[PROFILE_WINDOW];
+};
+
+// TraceEvent - one scope while a trace is recorded. phase is stored last,
+// -1 marks a slot that was claimed but not written yet.
+struct TraceEvent {
+	std::atomic<int> phase;
+	int              thread;
+	int64            begin, end;
+};
+
+static ProfilePhase     sPhase[PROFILE_PHASES];
+static std::atomic<int> sPhases(0);
+static StaticMutex      sPhaseLock;
+
+static Buffer<TraceEvent> sEvent; // PROFILE_EVENTS, allocated by the first trace
+static std::atomic<int>   sEventLimit(0);
+static std::atomic<int>   sEvents(0);
+static std::atomic<bool>  sTracing(false);
+static int64              sTraceStart;
+
+static std::atomic<int>   sThreads(0);
+static thread_local int   sThread = -1;
+static VectorMap<int, String> sThreadName; // by trace id, of the threads that were named
+static StaticMutex        sThreadLock;
+
+static int GetTraceThread() {
+	if (sThread < 0)
+		sThread = sThreads++;
+	return sThread;
+}
+
+int64 ProfileClock() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProfilePhase& GetProfilePhase(const char *name) {
+	Mutex::Lock __(sPhaseLock);
+	int n = sPhases.load(std::memory_order_relaxed);
+	for (int i = 0; i < n; i++)
+		if (strcmp(sPhase[i].name, name) == 0)
+			return sPhase[i];
+	
+	// the last one collects the phases beyond the limit
+	if (n == PROFILE_PHASES)
+		return sPhase[n - 1];
+	
+	ProfilePhase& p = sPhase[n];
+	p.name = name;
+	p.id = n;
+	p.calls = 0;
+	for (auto& t : p.ns)
+		t = 0;
+	sPhases.store(n + 1, std::memory_order_release);
+	return p;
+}
+
+void ProfileAdd(ProfilePhase& phase, int64 begin, int64 end) {
+	int64 i = phase.calls.fetch_add(1, std::memory_order_relaxed);
+	phase.ns[i % PROFILE_WINDOW].store(end - begin, std::memory_order_relaxed);
+	
+	if (!sTracing.load(std::memory_order_relaxed))
+		return;
+	
+	int e = sEvents.fetch_add(1, std::memory_order_relaxed);
+	if (e >= sEventLimit.load(std::memory_order_relaxed))
+		return;
+	
+	TraceEvent& ev = sEvent[e];
+	ev.thread = GetTraceThread();
+	ev.begin = begin;
+	ev.end = end;
+	ev.phase.store(phase.id, std::memory_order_release);
+}
+
+static int GetBucket(double us) {
+	int b = 0;
+	while (us >= 1 && b < PROFILE_BUCKETS - 1) {
+		us /= 2;
+		b++;
+	}
+	return b;
+}
+
+Vector<ProfileStats> GetProfileStats() {
+	Vector<ProfileStats> out;
+	int n = sPhases.load(std::memory_order_acquire);
+	Vector<double> us;
+	
+	for (int i = 0; i < n; i++) {
+		const ProfilePhase& p = sPhase[i];
+		ProfileStats& st = out.Add();
+		st.name = p.name;
+		st.calls = p.calls.load(std::memory_order_relaxed);
+		st.count = (int)min<int64>(st.calls, PROFILE_WINDOW);
+		st.mean = st.p50 = st.p99 = st.max = 0;
+		memset(st.histogram, 0, sizeof(st.histogram));
+		
+		us.SetCount(st.count);
+		double sum = 0;
+		for (int j = 0; j < st.count; j++) {
+			us[j] = p.ns[j].load(std::memory_order_relaxed) / 1e3;
+			sum += us[j];
+			st.histogram[GetBucket(us[j])]++;
+		}
+		if (st.count == 0)
+			continue;
+		
+		Sort(us);
+		st.mean = sum / st.count;
+		st.p50 = us[st.count / 2];
+		st.p99 = us[min(st.count * 99 / 100, st.count - 1)];
+		st.max = us.Top();
+	}
+	return out;
+}
+
+void SetProfileThreadName(const char *name) {
+	int id = GetTraceThread();
+	Mutex::Lock __(sThreadLock);
+	sThreadName.GetAdd(id) = name;
+}
+
+void StartProfileTrace(int max_events) {
+	StopProfileTrace();
+	max_events = minmax(max_events, 1, (int)PROFILE_EVENTS);
+	// never freed, as a scope that saw the last trace may still write to it.
+	// No scope has seen one before the first.
+	if (!sEvent)
+		sEvent.Alloc(PROFILE_EVENTS);
+	for (int i = 0; i < max_events; i++)
+		sEvent[i].phase.store(-1, std::memory_order_relaxed);
+	sEventLimit = max_events;
+	sEvents = 0;
+	sTraceStart = ProfileClock();
+	sTracing.store(true, std::memory_order_release);
+}
+
+void StopProfileTrace() {
+	sTracing.store(false, std::memory_order_release);
+}
+
+static String JsonString(const char *s) {
+	String r = "\"";
+	for (; *s; s++)
+		if (*s == '\"' || *s == '\\')
+			r << '\\' << *s;
+		else if ((byte)*s >= ' ')
+			r << *s;
+	return r << '\"';
+}
+
+bool SaveProfileTrace(const char *path) {
+	if (sEventLimit == 0)
+		return false;
+	
+	// timestamps and durations are in us, relative to StartProfileTrace
+	String json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	bool first = true;
+	{
+		Mutex::Lock __(sThreadLock);
+		for (int i = 0; i < sThreadName.GetCount(); i++) {
+			json << (first ? "" : ",\n")
+			     << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << sThreadName.GetKey(i)
+			     << ",\"args\":{\"name\":" << JsonString(sThreadName[i]) << "}}";
+			first = false;
+		}
+	}
+	
+	int n = min(sEvents.load(std::memory_order_acquire), sEventLimit.load());
+	for (int i = 0; i < n; i++) {
+		const TraceEvent& ev = sEvent[i];
+		int phase = ev.phase.load(std::memory_order_acquire);
+		if (phase < 0)
+			continue;
+		json << (first ? "" : ",\n")
+		     << "{\"name\":" << JsonString(sPhase[phase].name)
+		     << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ev.thread
+		     << Format(",\"ts\":%.3f,\"dur\":%.3f}", (ev.begin - sTraceStart) / 1e3,
+		               (ev.end - ev.begin) / 1e3);
+		first = false;
+	}
+	json << "\n]}\n";
+	
+	return SaveFile(path, json);
+}
+
+#endif
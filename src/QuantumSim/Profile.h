@@ -0,0 +1,81 @@
+#ifndef _QuantumSim_Profile_h_
+#define _QuantumSim_Profile_h_
+
+// Scoped timers of the phases of a frame: the FFTs and multiplies of a step,
+// the hand-over of psi, the colormap conversion and the blits of Paint.
+// PROFILE_SCOPE("name") times the rest of the enclosing block. The last
+// PROFILE_WINDOW durations of each phase make up its rolling histogram; while
+// a trace is recorded, every scope also becomes an event of a Chrome trace
+// (chrome://tracing, ui.perfetto.dev).
+// Only built with the PROFILE flag. Without it PROFILE_SCOPE expands to
+// nothing and the functions below do nothing.
+
+enum {
+	PROFILE_WINDOW  = 256, // durations per phase in the rolling histogram
+	PROFILE_BUCKETS = 16,  // bucket b holds durations of 2^(b-1) .. 2^b us, 0 below 1 us
+	PROFILE_PHASES  = 64,  // most phases that can be registered
+	PROFILE_EVENTS  = 1 << 20, // most events of a trace
+};
+
+// ProfileStats - one phase over its last PROFILE_WINDOW calls
+struct ProfileStats {
+	String name;
+	int64  calls;  // since the start of the program
+	int    count;  // calls in the window
+	double mean, p50, p99, max; // us
+	int    histogram[PROFILE_BUCKETS];
+};
+
+#ifdef flagPROFILE
+
+struct ProfilePhase;
+
+int64 ProfileClock(); // ns of a monotonic clock
+// GetProfilePhase - the phase of this name, registered on first use. name
+// must stay valid, i.e. be a literal.
+ProfilePhase& GetProfilePhase(const char *name);
+void ProfileAdd(ProfilePhase& phase, int64 begin, int64 end);
+
+struct ProfileScope : NoCopy {
+	ProfilePhase& phase;
+	int64         begin;
+	
+	ProfileScope(ProfilePhase& phase) : phase(phase) {begin = ProfileClock();}
+	~ProfileScope() {ProfileAdd(phase, begin, ProfileClock());}
+};
+
+// the phase is looked up once per call site
+#define PROFILE_SCOPE(name) \
+	static ProfilePhase& COMBINE(profile_phase_, __LINE__) = GetProfilePhase(name); \
+	ProfileScope COMBINE(profile_scope_, __LINE__)(COMBINE(profile_phase_, __LINE__))
+
+// the phases in order of registration
+Vector<ProfileStats> GetProfileStats();
+// SetProfileThreadName - the name of the calling thread in the trace
+void SetProfileThreadName(const char *name);
+
+// StartProfileTrace - record the following scopes, up to max_events of them,
+// at most PROFILE_EVENTS
+void StartProfileTrace(int max_events = PROFILE_EVENTS);
+void StopProfileTrace();
+// SaveProfileTrace - the recorded events as Chrome trace-event JSON, after
+// StopProfileTrace
+bool SaveProfileTrace(const char *path);
+
+inline bool IsProfileBuild() {return true;}
+
+#else
+
+#define PROFILE_SCOPE(name)
+
+inline Vector<ProfileStats> GetProfileStats() {return Vector<ProfileStats>();}
+inline void SetProfileThreadName(const char *) {}
+inline void StartProfileTrace(int = 0) {}
+inline void StopProfileTrace() {}
+inline bool SaveProfileTrace(const char *) {return false;}
+
+inline bool IsProfileBuild() {return false;}
+
+#endif
+
+#endif
@@ -0,0 +1,250 @@
+#include "QuantumSim.h"
+
+static const char *s_integrator_name[INTEGRATOR_COUNT] = {"lie", "strang", "yoshida"};
+
+const char *GetIntegratorName(int integrator) {
+	return integrator >= 0 && integrator < INTEGRATOR_COUNT ? s_integrator_name[integrator] : "?";
+}
+
+int FindIntegrator(const char *name) {
+	for (int i = 0; i < INTEGRATOR_COUNT; i++)
+		if (strcmp(name, s_integrator_name[i]) == 0)
+			return i;
+	return -1;
+}
+
+int GetIntegratorOrder(int integrator) {
+	return integrator == INTEGRATOR_YOSHIDA ? 4 : integrator == INTEGRATOR_STRANG ? 2 : 1;
+}
+
+int GetIntegratorFfts(int integrator) {
+	return integrator == INTEGRATOR_YOSHIDA ? 3 : 1;
+}
+
+double GetKineticYScale() {
+	return sqr((double)FIELD_WIDTH / FIELD_HEIGHT);
+}
+
+// GetReach - tiles of size tile crossed at v cells per step, at least the
+// neighbours and at most the whole axis of tiles
+static int GetReach(double v, int tile, int tiles) {
+	return minmax((int)ceil(v / tile), 1, max(tiles / 2, 1));
+}
+
+// FillKinetic - exp(-i phase k^2) for the n frequencies of an axis in FFTW
+// order; for odd sizes the middle bin is still positive
+template <class Complex>
+static void FillKinetic(Complex *t, int n, double phase) {
+	for (int x = 0; x < n; x++) {
+		int k = x < (n + 1) / 2 ? x : x - n;
+		t[x][0] = cos(phase * -k * k);
+		t[x][1] = sin(phase * -k * k);
+	}
+}
+
+// FillPotential - the position propagator for each red value of the track
+template <class Complex>
+static void FillPotential(Complex *lut, double dt) {
+	for (int i = 0; i < 256; i++) {
+		lut[i][0] = i > 250 ? 0 : cos(-.5 * (double)i * dt * 30000 / 255);
+		lut[i][1] = i > 250 ? 0 : sin(-.5 * (double)i * dt * 30000 / 255);
+	}
+}
+
+template <class Real>
+Propagator_<Real>::Propagator_(int width, int height, double dt) {
+	this->width = width;
+	this->height = height;
+	this->dt = dt;
+	this->stride = GetRowStride(width);
+	
+	kx = FftwOf<Real>::Malloc(width);
+	ky = FftwOf<Real>::Malloc(height);
+	cells.Alloc(stride * height);
+	potential = ~cells;
+	
+	tiles_x = GetTilesX(width);
+	tiles_y = GetTilesY(height);
+	wall.Alloc(tiles_x * tiles_y);
+	
+	integrator = INTEGRATOR_LIE;
+	stages = 0;
+	for (int i = 0; i < SPLIT_STAGES; i++)
+		stage[i].kx = stage[i].ky = NULL;
+	
+	BuildMomentum();
+	
+	// The padding at the end of each row stays a wall for good, which keeps
+	// psi zero there and lets the pointwise loops run over whole rows.
+	memset(~cells, 255, stride * height);
+	
+	FillPotential(xlut, dt);
+	
+	BuildWalls();
+}
+
+template <class Real>
+Propagator_<Real>::~Propagator_() {
+	FftwOf<Real>::Free(kx);
+	FftwOf<Real>::Free(ky);
+	
+	for (int i = 0; i < SPLIT_STAGES; i++) {
+		FftwOf<Real>::Free(stage[i].kx);
+		FftwOf<Real>::Free(stage[i].ky);
+	}
+}
+
+// SetIntegrator - set up the stages of a step. The position parts only
+// depend on dt, so the track can be changed afterwards.
+template <class Real>
+void Propagator_<Real>::SetIntegrator(int integrator) {
+	// Yoshida's triple jump, w0 + 2 w1 = 1 and w0^3 + 2 w1^3 = 0
+	double w1 = 1 / (2 - cbrt(2.));
+	double w0 = 1 - 2 * w1;
+	
+	double position[SPLIT_STAGES] = {0};
+	double momentum[SPLIT_STAGES] = {0};
+	
+	this->integrator = integrator;
+	switch (integrator) {
+	case INTEGRATOR_STRANG:
+		stages = 2;
+		position[0] = position[1] = .5;
+		momentum[0] = 1;
+		break;
+	case INTEGRATOR_YOSHIDA:
+		stages = 4;
+		position[0] = position[3] = w1 / 2;
+		position[1] = position[2] = (w0 + w1) / 2;
+		momentum[0] = momentum[2] = w1;
+		momentum[1] = w0;
+		break;
+	default:
+		this->integrator = INTEGRATOR_LIE;
+		stages = 0;
+		break;
+	}
+	
+	for (int i = 0; i < SPLIT_STAGES; i++) {
+		Stage& s = stage[i];
+		s.position = position[i];
+		s.momentum = momentum[i];
+		FillPotential(s.xlut, s.position * dt);
+		
+		if (s.momentum != 0 && !s.kx) {
+			s.kx = FftwOf<Real>::Malloc(width);
+			s.ky = FftwOf<Real>::Malloc(height);
+		}
+	}
+	
+	BuildMomentum();
+}
+
+template <class Real>
+void Propagator_<Real>::BuildMomentum() {
+	double yscale = GetKineticYScale();
+	
+	FillKinetic(kx, width, dt);
+	FillKinetic(ky, height, dt * yscale);
+	
+	double longest = stages ? 0 : 1; // of the momentum parts, in dt
+	for (int i = 0; i < stages; i++)
+		if (stage[i].momentum != 0) {
+			FillKinetic(stage[i].kx, width, stage[i].momentum * dt);
+			FillKinetic(stage[i].ky, height, stage[i].momentum * dt * yscale);
+			longest = max(longest, fabs(stage[i].momentum));
+		}
+	
+	// frequency k of an axis of n cells turns by phase k^2 and so moves
+	// phase k n / pi cells, at most phase n^2 / 2pi at the Nyquist frequency.
+	// The position passes between the momentum parts skip by these reaches.
+	reach_x = GetReach(longest * dt * width * width / (2 * M_PI), TILE_WIDTH, tiles_x);
+	reach_y = GetReach(longest * dt * yscale * height * height / (2 * M_PI), TILE_HEIGHT, tiles_y);
+}
+
+// BuildPosition - extract the potential from a bitmap with color-coded
+// obstacle height. A bitmap of another size than the grid is resampled first.
+template <class Real>
+void Propagator_<Real>::BuildPosition(const Image& V) {
+	if (V.GetSize() != Size(width, height)) {
+		BuildPosition(ResamplePotential(V, Size(width, height)));
+		return;
+	}
+	
+	const RGBA *V_dat = V.Begin();
+	ASSERT(V_dat);
+	
+	potential = ~cells;
+	for (int y = 0; y < height; y++) {
+		byte *row = ~cells + y * stride;
+		
+		for (int x = 0; x < width; x++)
+			row[x] = V_dat++->r;
+	}
+	
+	BuildWalls();
+}
+
+template <class Real>
+void Propagator_<Real>::SetPotential(const byte *p) {
+	potential = p;
+	BuildWalls();
+}
+
+// BuildWalls - find the tiles where the position propagator is zero everywhere
+template <class Real>
+void Propagator_<Real>::BuildWalls() {
+	for (int ty = 0; ty < tiles_y; ty++)
+		for (int tx = 0; tx < tiles_x; tx++) {
+			int x0 = tx * TILE_WIDTH;
+			int x1 = min(x0 + TILE_WIDTH, stride);
+			bool absorbs = true;
+			
+			for (int y = ty * TILE_HEIGHT; y < min((ty + 1) * TILE_HEIGHT, height) && absorbs; y++) {
+				const byte *row = potential + y * stride;
+				for (int x = x0; x < x1; x++)
+					if (xlut[row[x]][0] != 0 || xlut[row[x]][1] != 0) {
+						absorbs = false;
+						break;
+					}
+			}
+			
+			wall[ty * tiles_x + tx] = absorbs;
+		}
+}
+
+template struct Propagator_<float>;
+template struct Propagator_<double>;
+
+template <class Real>
+const Propagator_<Real>& PropagatorCache_<Real>::Get(const Image& V, Size grid, double dt,
+                                                     int integrator) {
+	tick++;
+	
+	int oldest = -1;
+	for (int i = 0; i < entry.GetCount(); i++) {
+		Entry& e = entry[i];
+		const Propagator_<Real>& p = *e.prop;
+		if (e.serial == V.GetSerialId() && p.width == grid.cx && p.height == grid.cy &&
+		    p.dt == dt && p.integrator == integrator) {
+			e.used = tick;
+			return p;
+		}
+		if (oldest < 0 || e.used < entry[oldest].used)
+			oldest = i;
+	}
+	
+	if (entry.GetCount() >= limit)
+		entry.Remove(oldest);
+	
+	Entry& e = entry.Add();
+	e.serial = V.GetSerialId();
+	e.used = tick;
+	e.prop = new Propagator_<Real>(grid.cx, grid.cy, dt);
+	e.prop->SetIntegrator(integrator);
+	e.prop->BuildPosition(V);
+	return *e.prop;
+}
+
+template class PropagatorCache_<float>;
+template class PropagatorCache_<double>;
@@ -0,0 +1,129 @@
+#ifndef _QuantumSim_Propagator_h_
+#define _QuantumSim_Propagator_h_
+
+// the grid is split into tiles of TILE_WIDTH x TILE_HEIGHT cells, so the
+// position step can skip the parts of the grid the wave cannot be in. The
+// last column of tiles includes the padding of the rows.
+enum { TILE_WIDTH = 64, TILE_HEIGHT = 8 };
+
+// rows of psi are padded to a multiple of ROW_ALIGN cells (one 64-byte cache line)
+enum { ROW_ALIGN = 8 };
+
+inline int GetRowStride(int width) {return (width + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;}
+inline int GetTilesX(int width)    {return (GetRowStride(width) + TILE_WIDTH - 1) / TILE_WIDTH;}
+inline int GetTilesY(int height)   {return (height + TILE_HEIGHT - 1) / TILE_HEIGHT;}
+
+// split-step integrators, in order of accuracy
+enum {
+	INTEGRATOR_LIE,     // momentum, then position; first order, one FFT pair per step
+	INTEGRATOR_STRANG,  // half position, momentum, half position; second order, one FFT pair
+	INTEGRATOR_YOSHIDA, // three Strang steps of w1, w0, w1 dt; fourth order, three FFT pairs
+	INTEGRATOR_COUNT
+};
+
+const char *GetIntegratorName(int integrator);
+int         FindIntegrator(const char *name); // -1 if unknown
+int         GetIntegratorOrder(int integrator);
+int         GetIntegratorFfts(int integrator); // FFT pairs per step
+
+// GetKineticYScale - the weight of ky^2 against kx^2 in the kinetic phase per
+// frequency index, (FIELD_WIDTH / FIELD_HEIGHT)^2. The field stays 2:1 on any
+// grid, FieldGauss scales x and y apart, so it does not depend on the grid.
+double      GetKineticYScale();
+
+enum { SPLIT_STAGES = 4 };
+
+#define POTENTIAL_SCALE (.5 * 30000 / 255) // V per unit of red in the track, see FillPotential
+
+// Propagator - the tables of the split-step scheme for one grid, timestep and
+// track. Stepping only reads them, so simulators running shots on the same
+// track can share one, see QuantumSimulator::SetPropagator. Real is the
+// precision of the tables and of the simulators using them.
+template <class Real>
+struct Propagator_ : NoCopy {
+	typedef typename FftwOf<Real>::Complex Complex;
+	
+	// Stage - part of a step of the higher order integrators: the position
+	// propagator for a fraction of dt, then the momentum propagator for another
+	// fraction. The momentum part of the last stage is empty.
+	struct Stage {
+		double   position, momentum; // fractions of dt
+		Complex  xlut[256];
+		Complex *kx, *ky;             // NULL if momentum is 0
+	};
+	
+	int    width, height;
+	int    stride;           // cells per row of psi, including the padding
+	double dt;
+	
+	// the propagator in momentum space is separable,
+	// exp(-i dt (kx^2 + yscale ky^2)) = kx[x] * ky[y]
+	Complex *kx;
+	Complex *ky;
+	
+	// the propagator in position space only depends on the red channel of
+	// the track, so it is kept as one byte per cell plus a 256-entry table.
+	// Entries above 250 are zero and absorb the wave (walls, padding).
+	// potential points to cells, or to memory given to SetPotential.
+	const byte   *potential;
+	Buffer<byte>  cells;
+	Complex       xlut[256];
+	
+	int           tiles_x, tiles_y;
+	Buffer<byte>  wall;      // per tile, 1 if every cell absorbs
+	// tiles the wave can cross in the momentum part of a step, see BuildMomentum
+	int           reach_x, reach_y;
+	
+	// the stages of a step, none for INTEGRATOR_LIE, which uses the tables above
+	int           integrator;
+	int           stages;
+	Stage         stage[SPLIT_STAGES];
+	
+	void SetIntegrator(int integrator);
+	void BuildMomentum();
+	void BuildPosition(const Image& V);
+	// SetPotential - use p, stride bytes per row with walls in the padding,
+	// as it is, e.g. mapped from a track pack. p must outlive its use here.
+	void SetPotential(const byte *p);
+	void BuildWalls();
+	
+	// starts out with the momentum tables and a track that is all wall
+	Propagator_(int width, int height, double dt);
+	~Propagator_();
+};
+
+typedef Propagator_<float>  Propagator;
+typedef Propagator_<double> Propagator64;
+
+// PropagatorCache - the propagators of the tracks played last, keyed by the
+// track bitmap, the grid, dt and the integrator, so playing a track again or
+// going back to it builds nothing. Not thread-safe.
+template <class Real>
+class PropagatorCache_ : NoCopy {
+public:
+	// Get - the propagator of track V, built on first use. It stays valid until
+	// limit other ones have been asked for since.
+	const Propagator_<Real>& Get(const Image& V, Size grid, double dt, int integrator);
+	
+	void SetLimit(int n) {limit = max(n, 1);}
+	int  GetCount() const {return entry.GetCount();}
+	void Clear() {entry.Clear();}
+	
+	PropagatorCache_() {limit = 8; tick = 0;}
+	
+private:
+	struct Entry {
+		int64 serial;   // Image::GetSerialId of the track
+		int64 used;     // tick of the last Get
+		One< Propagator_<Real> > prop;
+	};
+	
+	Array<Entry> entry;
+	int limit;
+	int64 tick;
+};
+
+typedef PropagatorCache_<float>  PropagatorCache;
+typedef PropagatorCache_<double> PropagatorCache64;
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _QuantumSim_QuantumSim_h_
+#define _QuantumSim_QuantumSim_h_
+
+#include "QuantumSimulator.h"
+#include "Snapshot.h"
+#include "Render.h"
+#include "Kernels.h"
+#include "Fftw.h"
+#include "Measure.h"
+#include "Batch.h"
+#include "Profile.h"
+#include "Recorder.h"
+
+#include "Track.h"
+#include "TrackPack.h"
+#include "Shot.h"
+#include "WinMap.h"
+#include "Movie.h"
+
+#endif
@@ -0,0 +1,547 @@
+#include "QuantumSim.h"
+
+// constructor: setup the FFT engine, the propagator is built on first use
+template <class Real>
+QuantumSimulator_<Real>::QuantumSimulator_(int width, int height, double dt, int threads) {
+	this->dt = dt;
+	this->width = width;
+	this->height = height;
+	this->threads = threads = max(threads, 1);
+	this->stride = GetRowStride(width);
+	
+	psi = FftwOf<Real>::Malloc(stride * height);
+	
+	tiles_x = GetTilesX(width);
+	tiles_y = GetTilesY(height);
+	int tiles = tiles_x * tiles_y;
+	tile_norm.Alloc(2 * tiles);
+	tile_state.Alloc(tiles);
+	memset(~tile_state, TILE_ACTIVE, tiles);
+	tile_phase = 0;
+	tiles_valid = tiles_zero = false;
+	tile_total = 0;
+	tile_steps = tile_passes = 0;
+	idle_threshold = 1e-12;
+	observing = false;
+	// allocated up front, as Alloc must not run while a reader takes from it
+	observed_ring.Alloc(OBSERVE_RING);
+	
+	PlanFftw(width, height, stride, threads, psi, fft, ifft);
+	
+	// the propagator is constructed from the track, once the user has made its
+	// choice where to play, or shared, see Own
+	prop = NULL;
+	integrator = INTEGRATOR_LIE;
+	
+	Clear();
+			
+	GaussNorm = 0;
+	normlast = 1;
+	steps = 0;
+	
+	rng.Seed(Random64());
+	measure_rule = MEASURE_BORN;
+}
+
+template <class Real>
+QuantumSimulator_<Real>::~QuantumSimulator_(void) {
+	DestroyFftw(fft, ifft);
+	
+	FftwOf<Real>::Free(psi);
+}
+
+// the sums of a pass kept for the observables, per tile row of the position
+// pass and per chunk of rows of the momentum pass. The momentum pass keeps
+// kx in X and ky in Y.
+enum {
+	OBSERVE_P, OBSERVE_X, OBSERVE_XX, OBSERVE_Y, OBSERVE_YY, OBSERVE_V, OBSERVE_HOLE,
+	OBSERVE_SUMS
+};
+
+template <class Real>
+void QuantumSimulator_<Real>::SetObservables(bool b) {
+	if (!b) {
+		observing.store(false, std::memory_order_release);
+		return;
+	}
+	
+	observe_x.Alloc(2 * stride);
+	for (int x = 0; x < stride; x++)
+		observe_x[2 * x] = observe_x[2 * x + 1] = x < width ? (float)((double)x * FIELD_WIDTH / width) : 0;
+	
+	// FFTW order, as in FillKinetic
+	observe_k.Alloc(2 * width);
+	for (int x = 0; x < width; x++)
+		observe_k[2 * x] = observe_k[2 * x + 1] = (float)(x < (width + 1) / 2 ? x : x - width);
+	
+	if (!hole_span) {
+		hole_span.Alloc(2 * height);
+		memset(~hole_span, 0, 2 * height * sizeof(int));
+	}
+	
+	int rows = max(KERNEL_CHUNK / stride, 1);
+	observe_sum.Alloc(OBSERVE_SUMS * max(tiles_y, (height + rows - 1) / rows));
+	
+	observed = Observables();
+	// last, another thread may read the ring once it sees observing
+	observing.store(true, std::memory_order_release);
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::SetObservedHole(const Hole& hole) {
+	hole_span.Alloc(2 * height);
+	for (int y = 0; y < height; y++) {
+		// same grid to field conversion as HoleProbability
+		int fy = y * FIELD_HEIGHT / height;
+		int x0 = 0, x1 = 0;
+		for (int x = 0; x < width; x++)
+			if (hole.Contains(x * FIELD_WIDTH / width, fy)) {
+				if (x1 == 0)
+					x0 = x;
+				x1 = x + 1;
+			}
+		hole_span[2 * y] = x0;
+		hole_span[2 * y + 1] = x1;
+	}
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::Clear() {
+	memset(psi, 0, sizeof(Complex) * stride * height);
+	tiles_valid = tiles_zero = false;
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::BuildMomentumPropagator() {
+	Own().BuildMomentum();
+}
+
+template <class Real>
+typename QuantumSimulator_<Real>::Propagator& QuantumSimulator_<Real>::Own() {
+	if (!own) {
+		own = new Propagator(width, height, dt);
+		own->SetIntegrator(integrator);
+	}
+	return *own;
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::SetIntegrator(int integrator) {
+	this->integrator = integrator;
+	if (own)
+		own->SetIntegrator(integrator);
+}
+
+// BuildPositionPropagator - build up the position from a bitmap
+// with color-coded obstacle height
+template <class Real>
+void QuantumSimulator_<Real>::BuildPositionPropagator(const Image& V) {
+	prop = &Own();
+	own->BuildPosition(V);
+	tiles_valid = tiles_zero = false;
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::SetPotential(const byte *cells) {
+	prop = &Own();
+	own->SetPotential(cells);
+	tiles_valid = tiles_zero = false;
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::SetPropagator(const Propagator& p) {
+	ASSERT(p.width == width && p.height == height && p.dt == dt);
+	prop = &p;
+	tiles_valid = tiles_zero = false;
+}
+
+//PropagateMomentum -- FFT into k-space and apply the momentum propagator
+// to the wave function
+// effectively, this propagates the wavefunction by dt in a zero potential
+template <class Real>
+void QuantumSimulator_<Real>::PropagateMomentum() {
+	const Propagator& pr = Prop();
+	PropagateMomentum(pr.kx, pr.ky);
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::PropagateMomentum(const Complex *kx, const Complex *ky) {
+	// propagate in momentum space
+	{
+		PROFILE_SCOPE("fft");
+		FftwOf<Real>::Execute(fft);
+	}
+	{
+		PROFILE_SCOPE("momentum multiply");
+		int rows = max(KERNEL_CHUNK / stride, 1);
+		ForChunks(height, rows, threads, [&](int chunk, int begin, int end) {
+			if (!observing) {
+				for (int y = begin; y < end; y++)
+					ComplexMulScaled(psi + y * stride, kx, ky[y], width);
+				return;
+			}
+			
+			double *sum = ~observe_sum + OBSERVE_SUMS * chunk;
+			memset(sum, 0, OBSERVE_SUMS * sizeof(double));
+			for (int y = begin; y < end; y++) {
+				double m[3] = {0, 0, 0};
+				ComplexMulMoments(psi + y * stride, kx, ky[y], ~observe_k, width, m);
+				double k = y < (height + 1) / 2 ? y : y - height;
+				sum[OBSERVE_P] += m[0];
+				sum[OBSERVE_X] += m[1];
+				sum[OBSERVE_XX] += m[2];
+				sum[OBSERVE_Y] += k * m[0];
+				sum[OBSERVE_YY] += k * k * m[0];
+			}
+		});
+		
+		if (observing) {
+			double t[OBSERVE_SUMS] = {0};
+			for (int c = 0; c < (height + rows - 1) / rows; c++)
+				for (int i = 0; i < OBSERVE_SUMS; i++)
+					t[i] += observe_sum[OBSERVE_SUMS * c + i];
+			
+			double yscale = GetKineticYScale();
+			double p = t[OBSERVE_P] > 0 ? t[OBSERVE_P] : 1;
+			observed.kx = t[OBSERVE_X] / p;
+			observed.ky = t[OBSERVE_Y] / p;
+			observed.kinetic = (t[OBSERVE_XX] + yscale * t[OBSERVE_YY]) / p;
+		}
+	}
+	{
+		PROFILE_SCOPE("ifft");
+		FftwOf<Real>::Execute(ifft);
+	}
+}
+
+
+//PropagatePosition -- propagate in position space
+// and scale the wavefunction by a factor of quench
+// note that this operation is not unitary due to the
+// hard erase at infinite potentials, where the lookup table is zero
+// return value: the new norm of the propagated wavefunction
+template <class Real>
+double QuantumSimulator_<Real>::PropagatePosition(double quench) {
+	return PropagatePosition(quench, Prop().xlut);
+}
+
+template <class Real>
+double QuantumSimulator_<Real>::PropagatePosition(double quench, const Complex *lut) {
+	PROFILE_SCOPE("position multiply");
+	const Propagator& pr = Prop();
+	int tx = tiles_x;
+	double *next = ~tile_norm + (1 - tile_phase) * tx * tiles_y;
+	double limit = tiles_valid ? idle_threshold * tile_total : -1;
+	
+	//propagate the wavefunction.
+	// and correct for last time's shrink and the
+	// FFT's scaling
+	// Tiles the wave cannot be in are only cleared, see SetIdleThreshold.
+	ForChunks(tiles_y, 1, threads, [&](int ty, int, int) {
+		int y0 = ty * TILE_HEIGHT;
+		int y1 = min(y0 + TILE_HEIGHT, height);
+		
+		double *sum = observing ? ~observe_sum + OBSERVE_SUMS * ty : NULL;
+		if (sum)
+			memset(sum, 0, OBSERVE_SUMS * sizeof(double));
+		
+		for (int i = 0; i < tx; i++) {
+			int t = ty * tx + i;
+			int x0 = i * TILE_WIDTH;
+			int n = min(x0 + TILE_WIDTH, stride) - x0;
+			int state = pr.wall[t] ? TILE_WALL : IsQuiet(i, ty, limit) ? TILE_IDLE : TILE_ACTIVE;
+			double norm = 0;
+			
+			for (int y = y0; y < y1; y++) {
+				int offset = y * stride + x0;
+				if (state != TILE_ACTIVE)
+					memset(psi + offset, 0, sizeof(Complex) * n);
+				else if (!sum)
+					norm += LookupMulNorm(psi + offset, pr.potential + offset, lut, quench, n);
+				else
+					norm += ObserveRow(sum, lut, quench, x0, y, n);
+			}
+			
+			next[t] = norm;
+			tile_state[t] = state;
+		}
+	});
+	
+	if (observing) {
+		double s[OBSERVE_SUMS] = {0};
+		for (int ty = 0; ty < tiles_y; ty++)
+			for (int i = 0; i < OBSERVE_SUMS; i++)
+				s[i] += observe_sum[OBSERVE_SUMS * ty + i];
+		
+		double p = s[OBSERVE_P] > 0 ? s[OBSERVE_P] : 1;
+		observed.x = s[OBSERVE_X] / p;
+		observed.y = s[OBSERVE_Y] / p;
+		observed.sx = sqrt(max(s[OBSERVE_XX] / p - sqr(observed.x), 0.0));
+		observed.sy = sqrt(max(s[OBSERVE_YY] / p - sqr(observed.y), 0.0));
+		observed.potential = POTENTIAL_SCALE * s[OBSERVE_V] / p;
+		observed.hole = s[OBSERVE_HOLE] / p;
+	}
+	
+	// sum up in tile order, so the norm does not depend on the scheduling
+	double norm = 0;
+	for (int t = 0; t < tx * tiles_y; t++) {
+		norm += next[t];
+		tile_steps += tile_state[t] == TILE_ACTIVE;
+	}
+	
+	tile_phase = 1 - tile_phase;
+	tile_total = norm;
+	tile_passes++;
+	tiles_valid = true;
+	
+	norm /= GaussNorm * INTENS * INTENS;
+	
+	return norm;
+}
+
+// ObserveRow - the position pass of n cells of row y from x0 on, adding the
+// moments to sum. The row is split at the hole, so its part is summed on the
+// way. Returns the norm of the cells.
+template <class Real>
+double QuantumSimulator_<Real>::ObserveRow(double *sum, const Complex *lut, double quench,
+                                           int x0, int y, int n) {
+	int x1 = x0 + n;
+	int a = minmax(hole_span[2 * y], x0, x1);
+	int b = minmax(hole_span[2 * y + 1], a, x1);
+	Complex *row = psi + y * stride;
+	const byte *pot = prop->potential + y * stride;
+	
+	double m[4] = {0, 0, 0, 0};
+	LookupMulMoments(row + x0, pot + x0, lut, quench, ~observe_x + 2 * x0, a - x0, m);
+	double out = m[0];
+	LookupMulMoments(row + a, pot + a, lut, quench, ~observe_x + 2 * a, b - a, m);
+	double in = m[0] - out;
+	LookupMulMoments(row + b, pot + b, lut, quench, ~observe_x + 2 * b, x1 - b, m);
+	
+	double fy = (double)y * FIELD_HEIGHT / height;
+	sum[OBSERVE_P] += m[0];
+	sum[OBSERVE_X] += m[1];
+	sum[OBSERVE_XX] += m[2];
+	sum[OBSERVE_Y] += fy * m[0];
+	sum[OBSERVE_YY] += fy * fy * m[0];
+	sum[OBSERVE_V] += m[3];
+	sum[OBSERVE_HOLE] += in;
+	return m[0];
+}
+
+// IsQuiet - whether tile (tx, ty) and the tiles within the reach of the
+// propagator held at most limit after the last step, so the wave cannot have
+// got into it since. The FFT is periodic, so are the neighbours.
+template <class Real>
+bool QuantumSimulator_<Real>::IsQuiet(int tx, int ty, double limit) const {
+	if (limit < 0)
+		return false;
+	
+	int ntx = tiles_x;
+	int nty = tiles_y;
+	int rx = prop->reach_x;
+	int ry = prop->reach_y;
+	const double *last = ~tile_norm + tile_phase * ntx * nty;
+	
+	for (int dy = -ry; dy <= ry; dy++) {
+		int y = (ty + dy + nty) % nty;
+		for (int dx = -rx; dx <= rx; dx++)
+			if (last[y * ntx + (tx + dx + ntx) % ntx] > limit)
+				return false;
+	}
+	return true;
+}
+
+template <class Real>
+TileStats QuantumSimulator_<Real>::GetTileStats() const {
+	TileStats st;
+	st.tiles = tiles_x * tiles_y;
+	st.active = st.wall = st.idle = 0;
+	for (int t = 0; t < st.tiles; t++)
+		switch (tile_state[t]) {
+		case TILE_WALL: st.wall++; break;
+		case TILE_IDLE: st.idle++; break;
+		default:        st.active++; break;
+		}
+	st.mean_active = tile_passes ? (double)tile_steps / tile_passes : st.active;
+	return st;
+}
+
+//Step -- propagate psi by one timestep dt
+// the FFT pair scales psi by width*height, which is undone together with the
+// losses at the absorbing walls in the position step
+template <class Real>
+double QuantumSimulator_<Real>::Step(bool position_first) {
+	PROFILE_SCOPE("Step");
+	double quench = 1. / ((double)width * height) / sqrt(normlast);
+	const Propagator& pr = Prop();
+	
+	if (pr.stages) {
+		// the first position part renormalizes, each one after an FFT pair
+		// undoes its scaling. All but the last norm are thrown away.
+		double scale = 1 / sqrt(normlast);
+		for (int i = 0; i < pr.stages; i++) {
+			const typename Propagator::Stage& s = pr.stage[i];
+			normlast = PropagatePosition(scale, s.xlut);
+			if (s.momentum != 0) {
+				PropagateMomentum(s.kx, s.ky);
+				scale = 1. / ((double)width * height);
+			}
+		}
+		tiles_zero = true;
+	}
+	else if (position_first) {
+		normlast = PropagatePosition(quench);
+		PropagateMomentum();
+		tiles_zero = false;
+	}
+	else {
+		PropagateMomentum();
+		normlast = PropagatePosition(quench);
+		tiles_zero = true;
+	}
+	
+	ASSERT(IsFin(normlast));
+	steps++;
+	
+	if (observing) {
+		observed.step = steps;
+		observed.norm = normlast;
+		observed_ring.Put(observed);
+	}
+	return normlast;
+}
+
+//PositionMeasurement
+// performe a position measurement, i.e., randomly pick a point x, y
+// according to the probability distribution defined by the wavefunction psi
+template <class Real>
+void QuantumSimulator_<Real>::PositionMeasurement(int *x, int *y) {
+	PositionSampler sampler;
+	sampler.Build(*this, measure_rule);
+	
+	Point p = sampler.Sample(rng);
+	if (IsNull(p)) {
+		// nothing left on the track, the ball is lost anywhere
+		p.x = (int)(rng.Get() % width);
+		p.y = (int)(rng.Get() % height);
+	}
+	
+	*x = p.x;
+	*y = p.y;
+}
+
+// GenGauss
+// generate a coherent state (i.e. a Gaussian wavepacket centered around
+// cx, cy in position and around kx, ky in momentum space)
+template <class Real>
+void QuantumSimulator_<Real>::GenGauss(int cx, int cy, double kx, double ky, double w) {
+// commented out for uncertainty movie 070519
+	normlast = 1;
+	steps = 0;
+	tile_steps = tile_passes = 0;
+	tiles_valid = tiles_zero = false;
+	
+	GaussNorm = FillGauss(psi, width, height, stride, cx, cy, kx, ky, w);
+}
+
+template <class Real>
+double FillGauss(Real (*psi)[2], int width, int height, int stride,
+                 int cx, int cy, double kx, double ky, double w) {
+	int x, y, xeff, yeff;
+	double r;
+	double norm = 0;
+	
+	int xlower = (int)(cx - 2.5 * w);
+	
+	if (xlower < 0)
+		xlower = 0;
+		
+	int ylower = (int)(cy - 2.5 * w);
+	
+	if (ylower < 0)
+		ylower = 0;
+		
+	int xupper = (int)(cx + 2.5 * w);
+	
+	if (xupper > width)
+		xupper = width;
+		
+	int yupper = (int)(cy + 2.5 * w);
+	
+	if (yupper > height)
+		yupper = height;
+		
+	for (y = ylower; y < yupper; y++) {
+		yeff = y - cy;
+		
+		for (x = xlower; x < xupper; x++) {
+			xeff = x - cx;
+			r = exp(-.25 * (xeff * xeff + yeff * yeff) / w / w);
+			psi[stride*y+x][0] = r * cos(kx * xeff + ky * yeff);
+			psi[stride*y+x][1] = r * sin(kx * xeff + ky * yeff);
+			norm += psi[stride*y+x][0] * psi[stride*y+x][0] +
+					psi[stride*y+x][1] * psi[stride*y+x][1];
+		}
+	}
+	
+	for (y = ylower; y < yupper; y++) {
+		for (x = xlower; x < xupper; x++) {
+			psi[stride*y+x][0] *= INTENS;
+			psi[stride*y+x][1] *= INTENS;
+		}
+	}
+	
+	return norm;
+}
+
+//ClearWave - initialize psi with zeros
+template <class Real>
+void QuantumSimulator_<Real>::ClearWave(void) {
+	Clear();
+}
+
+static void CopyRow(float *dst, const fftwf_complex *src, int n) {
+	memcpy(dst, src, sizeof(fftwf_complex) * n);
+}
+
+static void CopyRow(float *dst, const fftw_complex *src, int n) {
+	for (int i = 0; i < n; i++) {
+		dst[2 * i] = (float)src[i][0];
+		dst[2 * i + 1] = (float)src[i][1];
+	}
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::GetPsi(float *dst) const {
+	for (int y = 0; y < height; y++)
+		CopyRow(dst + 2 * width * y, psi + stride * y, width);
+}
+
+template <class Real>
+void QuantumSimulator_<Real>::Snapshot(PsiFrame& frame) const {
+	PROFILE_SCOPE("Snapshot");
+	if (frame.width != width || frame.height != height) {
+		frame.psi.Alloc(2 * width * height);
+		frame.width = width;
+		frame.height = height;
+	}
+	GetPsi(frame.psi);
+	frame.step = steps;
+	frame.norm = normlast;
+	
+	int tiles = tiles_x * tiles_y;
+	if (frame.tiles_x != tiles_x || frame.tiles_y != tiles_y) {
+		frame.zero.Alloc(tiles);
+		frame.tiles_x = tiles_x;
+		frame.tiles_y = tiles_y;
+	}
+	for (int t = 0; t < tiles; t++)
+		frame.zero[t] = tiles_zero && tile_state[t] != TILE_ACTIVE;
+}
+
+template class QuantumSimulator_<float>;
+template class QuantumSimulator_<double>;
+
+template double FillGauss(float (*psi)[2], int, int, int, int, int, double, double, double);
+template double FillGauss(double (*psi)[2], int, int, int, int, int, double, double, double);
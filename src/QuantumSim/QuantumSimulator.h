@@ -0,0 +1,215 @@
+#pragma once
+
+// QuantumSimulator - the class implementing the numerical solution of the
+// time-dependent Schrödinger equation.
+// The solution is based on a time-splitting scheme.
+// The propagation is performed successively in momentum and position space
+// To propagate in momentum space, the wave function is fourier-transformed.
+// Real is the precision of psi and of the FFTs: QuantumSimulator (float) for
+// the game, QuantumSimulator64 (double) for validation runs. Norms are summed
+// in double either way.
+
+#include <fftw3.h>
+
+#include <Draw/Draw.h>
+using namespace Upp;
+
+#include "Rng.h"
+#include "Fftw.h"
+#include "Propagator.h"
+#include "Snapshot.h"
+
+struct Hole;
+
+enum { TILE_ACTIVE, TILE_WALL, TILE_IDLE };
+
+// TileStats - what the last position step did with the tiles of the grid
+struct TileStats {
+	int tiles;
+	int active; // propagated
+	int wall;   // zeroed, every cell absorbs
+	int idle;   // zeroed, the wave was not near
+	double mean_active; // active tiles per position pass since the wave packet was initialized
+};
+
+// Observables - the expectation values of psi after a step, computed within
+// the passes of the step, see QuantumSimulator::SetObservables. The position
+// values are those of the last position pass, the momentum values those of
+// the last momentum pass. Each pass normalizes its own sums.
+struct Observables {
+	int64  step;      // steps since the wave packet was initialized
+	double norm;      // as returned by Step
+	double x, y;      // <x>, <y> in field coordinates
+	double sx, sy;    // spread, sqrt(<x^2> - <x>^2), in field coordinates
+	double kx, ky;    // <k> in frequency indices of the FFT, see FieldGauss
+	double kinetic;   // <kx^2 + yscale ky^2>, as in the momentum propagator
+	double potential; // <V>, as in the position propagator
+	double hole;      // |psi|^2 in the hole relative to the total, see SetObservedHole
+	
+	double GetEnergy() const {return kinetic + potential;}
+	
+	Observables() {step = 0; norm = x = y = sx = sy = kx = ky = kinetic = potential = hole = 0;}
+};
+
+enum { OBSERVE_RING = 1024 }; // steps of Observables the ring of a simulator holds
+
+#define INTENS 120 // color intensity at maximal probability density, psi is scaled by it
+
+template <class Real>
+class QuantumSimulator_ {
+
+public:
+	typedef typename FftwOf<Real>::Complex Complex;
+	typedef typename FftwOf<Real>::Plan    Plan;
+	typedef Propagator_<Real>              Propagator;
+	
+	// width, height - the grid; any size works, FFTW is fastest when both
+	//                 factor into small primes
+	// threads - number of threads used by the FFTs and the pointwise loops
+	QuantumSimulator_(int width, int height, double dt, int threads = 1);
+	
+	void Clear();
+	
+	void BuildPositionPropagator(const Image& V);
+	// SetPotential - the position propagator from cells mapped from a track
+	// pack, without copying them, see Propagator::SetPotential
+	void SetPotential(const byte *cells);
+	void BuildMomentumPropagator();
+	
+	// SetPropagator - step with the tables of p instead of the own ones, until
+	// the next BuildPositionPropagator. p must match the grid and the timestep
+	// and outlive its use here. A simulator only ever stepped with shared
+	// tables builds none of its own.
+	void SetPropagator(const Propagator& p);
+	const Propagator& GetPropagator() {return Prop();}
+	
+	double PropagatePosition(double quench);
+	void PropagateMomentum();
+	// the same with other tables, e.g. those of a stage of the integrator
+	double PropagatePosition(double quench, const Complex *lut);
+	void PropagateMomentum(const Complex *kx, const Complex *ky);
+	
+	// SetIntegrator - the splitting of the own tables, INTEGRATOR_LIE by
+	// default. A shared Propagator brings its own.
+	void SetIntegrator(int integrator);
+	int  GetIntegrator() const {return prop ? prop->integrator : integrator;}
+	
+	// Step - one split-step iteration of length dt. The wavefunction is
+	// renormalized by the norm of the previous step, which is returned.
+	// position_first swaps the order of the two half operators of the Lie
+	// splitting; the symmetric integrators ignore it.
+	double Step(bool position_first = false);
+	
+	// return the result of a position measurement on psi, drawn by the
+	// measurement rule, |psi|^2 unless set otherwise
+	void PositionMeasurement(int *x, int *y);
+	// SeedMeasurement - make the following measurements reproducible
+	void SeedMeasurement(uint64 seed) {rng.Seed(seed);}
+	// SetMeasurementRule - MEASURE_BORN or MEASURE_CLASSIC, see Measure.h
+	void SetMeasurementRule(int rule) {measure_rule = rule;}
+	int  GetMeasurementRule() const   {return measure_rule;}
+	
+	// SetIdleThreshold - the position step zeroes the tiles that, together
+	// with the tiles within the reach of the wave in a step (Propagator::reach_x),
+	// held less than eps of the norm after the last step, instead of
+	// propagating them. 0 propagates every tile off the walls.
+	void SetIdleThreshold(double eps) {idle_threshold = eps;}
+	TileStats GetTileStats() const;
+	const byte *GetTileState() const {return tile_state;} // TILE_ACTIVE .. per tile
+	
+	// GenGauss - initialize psi with a gaussian wavepacket of width w,
+	// centered around cx and cy in position and around kx and ky in momentum space
+	void GenGauss(int cx, int cy, double kx, double ky, double w);
+	void ClearWave(void);
+	
+	// GetPsi - copy psi into dst as (re, im) pairs, row by row, converted
+	// to float for QuantumSimulator64
+	void GetPsi(float *dst) const;
+	// Snapshot - copy psi and the step state into a frame for another thread
+	void Snapshot(PsiFrame& frame) const;
+	
+	int GetWidth() const {return width;}
+	int GetHeight() const {return height;}
+	Size GetSize() const {return Size(width, height);}
+	int GetStride() const {return stride;}
+	double GetDt() const {return dt;}
+	double GetNorm() const {return normlast;}
+	int64 GetStepCount() const {return steps;}
+	int GetThreads() const {return threads;}
+	
+	// SetObservables - compute the Observables during the passes of each step
+	// over psi, and put them into a ring of OBSERVE_RING steps for another
+	// thread. Off by default, as it costs a few extra multiplies per cell.
+	// Called by the thread stepping, IsObserving may be read by any thread.
+	void SetObservables(bool b);
+	bool IsObserving() const {return observing.load(std::memory_order_acquire);}
+	// SetObservedHole - the cells whose |psi|^2 counts as in the hole, those
+	// that map into it like the ball in the game
+	void SetObservedHole(const Hole& hole);
+	// GetObservables - of the last step, for the thread stepping
+	const Observables& GetObservables() const {return observed;}
+	RingBuffer<Observables>& GetObservableRing() {return observed_ring;}
+	
+	// psi is stored row by row, cell (x, y) at [y * GetStride() + x]. Rows are
+	// padded to whole cache lines; the padding cells are kept zero.
+	Complex *psi; // the complex wavefunction
+	
+	Complex& Psi(int x, int y) {return psi[y * stride + x];}
+	const Complex& Psi(int x, int y) const {return psi[y * stride + x];}
+	
+public:
+	~QuantumSimulator_(void);
+	
+private:
+	bool IsQuiet(int tx, int ty, double limit) const;
+	double ObserveRow(double *sum, const Complex *lut, double quench, int x0, int y, int n);
+	
+	// Own - the tables of this simulator, built on first use with the momentum
+	// tables and a track that is all wall
+	Propagator& Own();
+	const Propagator& Prop() {return prop ? *prop : *(prop = &Own());}
+	
+	One<Propagator> own;	// the tables built by this simulator, if any
+	const Propagator *prop;	// the tables in use, own or shared, NULL until needed
+	int integrator;			// of own
+	int tiles_x, tiles_y;	// see Propagator
+	
+	Plan fft, ifft; // plans for the Fourier transformations
+	// into momentum and position space
+	double dt;			// the timestep
+	int width, height;
+	int stride;				// cells per row, including the padding
+	int threads;
+	Buffer<double> tile_norm;	// |psi|^2 per tile after the last two steps, alternating
+	Buffer<byte> tile_state;	// TILE_ACTIVE .. per tile in the last position step
+	int tile_phase;			// which half of tile_norm holds the last step
+	bool tiles_valid;		// tile_norm describes psi
+	bool tiles_zero;		// psi is zero on the tiles not active, i.e. position went last
+	double tile_total;		// sum of tile_norm of the last step
+	int64 tile_steps;		// active tiles summed over the position passes since GenGauss
+	int64 tile_passes;		// position passes since GenGauss
+	double idle_threshold;
+	double GaussNorm;		// Norm of the wave packet after initialization
+	double normlast;		// Norm returned by the last position step
+	int64 steps;			// Steps since the wave packet was initialized
+	Rng rng;				// random numbers of the position measurement
+	int measure_rule;
+	
+	std::atomic<bool> observing;	// set last by SetObservables, read by the reader of the ring
+	Observables observed;
+	RingBuffer<Observables> observed_ring;
+	Buffer<float> observe_x;	// field x per cell of a row, twice, see LookupMulMoments
+	Buffer<float> observe_k;	// frequency index per cell of a row, twice
+	Buffer<int> hole_span;		// per row, the cells [x0, x1) in the hole
+	Buffer<double> observe_sum;	// sums of a pass per tile row or chunk of rows
+	
+};
+
+typedef QuantumSimulator_<float>  QuantumSimulator;
+typedef QuantumSimulator_<double> QuantumSimulator64;
+
+// FillGauss - write a gaussian wavepacket scaled by INTENS into a grid of psi,
+// see QuantumSimulator::GenGauss. Returns its norm before the scaling.
+template <class Real>
+double FillGauss(Real (*psi)[2], int width, int height, int stride,
+                 int cx, int cy, double kx, double ky, double w);
@@ -0,0 +1,484 @@
+#include "QuantumSim.h"
+
+enum { PSIREC_HEADER = 40, PSIREC_FRAME = 36 };
+
+const char *GetQuantName(int quant) {
+	static const char *name[] = {"byte", "half"};
+	return quant >= 0 && quant < PSI_QUANT_COUNT ? name[quant] : "?";
+}
+
+int FindQuant(const char *name) {
+	for (int q = 0; q < PSI_QUANT_COUNT; q++)
+		if (strcmp(name, GetQuantName(q)) == 0)
+			return q;
+	return -1;
+}
+
+static double PeekDouble(const byte *p) {
+	int64 bits = Peek64le(p);
+	double x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+static void PutDouble(Stream& out, double x) {
+	int64 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	out.Put64le(bits);
+}
+
+static float PeekFloat(const byte *p) {
+	int bits = Peek32le(p);
+	float x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+static void PutFloat(Stream& out, float x) {
+	int bits;
+	memcpy(&bits, &x, sizeof(bits));
+	out.Put32le(bits);
+}
+
+static int GetPlanes(int quant) {
+	return quant == PSI_QUANT_HALF ? 4 : 2;
+}
+
+// IEEE 754 binary16, rounded to nearest even
+static word FloatToHalf(float f) {
+	uint32 x;
+	memcpy(&x, &f, 4);
+	uint32 sign = (x >> 16) & 0x8000;
+	uint32 m = x & 0x7fffff;
+	int    e = (int)((x >> 23) & 0xff) - 127 + 15;
+	
+	if (((x >> 23) & 0xff) == 0xff)
+		return (word)(sign | 0x7c00 | (m ? 0x200 : 0));
+	if (e >= 31)
+		return (word)(sign | 0x7c00);
+	if (e <= 0) { // subnormal
+		if (e < -10)
+			return (word)sign;
+		m |= 0x800000;
+		int shift = 14 - e;
+		uint32 h = m >> shift;
+		uint32 rest = m & ((1u << shift) - 1);
+		uint32 half = 1u << (shift - 1);
+		if (rest > half || (rest == half && (h & 1)))
+			h++;
+		return (word)(sign | h);
+	}
+	uint32 h = ((uint32)e << 10) | (m >> 13);
+	uint32 rest = m & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++; // a carry into the exponent is still right
+	return (word)(sign | h);
+}
+
+static float HalfToFloat(word h) {
+	uint32 sign = (uint32)(h & 0x8000) << 16;
+	uint32 m = h & 0x3ff;
+	int    e = (h >> 10) & 0x1f;
+	uint32 x;
+	
+	if (e == 31)
+		x = sign | 0x7f800000 | (m << 13);
+	else if (e)
+		x = sign | ((uint32)(e + 127 - 15) << 23) | (m << 13);
+	else if (m) { // subnormal
+		e = 1;
+		while (!(m & 0x400)) {
+			m <<= 1;
+			e--;
+		}
+		x = sign | ((uint32)(e + 127 - 15) << 23) | ((m & 0x3ff) << 13);
+	}
+	else
+		x = sign;
+	
+	float f;
+	memcpy(&f, &x, 4);
+	return f;
+}
+
+// Quantize - psi of frame into planes, returns the scale of PSI_QUANT_BYTE
+static float Quantize(const PsiFrame& frame, int quant, byte *out) {
+	int n = frame.width * frame.height;
+	const float *psi = ~frame.psi;
+	
+	if (quant == PSI_QUANT_HALF) {
+		for (int i = 0; i < n; i++) {
+			word re = FloatToHalf(psi[2 * i]);
+			word im = FloatToHalf(psi[2 * i + 1]);
+			out[i] = (byte)re;
+			out[n + i] = (byte)(re >> 8);
+			out[2 * n + i] = (byte)im;
+			out[3 * n + i] = (byte)(im >> 8);
+		}
+		return 1;
+	}
+	
+	double peak = 0;
+	for (int i = 0; i < n; i++)
+		peak = max(peak, (double)psi[2 * i] * psi[2 * i] + (double)psi[2 * i + 1] * psi[2 * i + 1]);
+	float scale = (float)sqrt(peak);
+	double inv = scale > 0 ? 1 / (double)scale : 0;
+	
+	// the square root of the magnitude keeps the faint parts of the wave
+	for (int i = 0; i < n; i++) {
+		double re = psi[2 * i];
+		double im = psi[2 * i + 1];
+		double a = sqrt(sqrt(re * re + im * im) * inv);
+		out[i] = (byte)min((int)(255 * a + .5), 255);
+		out[n + i] = (byte)((int)floor(atan2(im, re) * 128 / M_PI + .5) & 255);
+	}
+	return scale;
+}
+
+static void Dequantize(const byte *in, int quant, float scale, PsiFrame& frame) {
+	int n = frame.width * frame.height;
+	float *psi = ~frame.psi;
+	
+	if (quant == PSI_QUANT_HALF) {
+		for (int i = 0; i < n; i++) {
+			psi[2 * i] = HalfToFloat((word)(in[i] | in[n + i] << 8));
+			psi[2 * i + 1] = HalfToFloat((word)(in[2 * n + i] | in[3 * n + i] << 8));
+		}
+		return;
+	}
+	
+	float magnitude[256], c[256], s[256];
+	for (int i = 0; i < 256; i++) {
+		magnitude[i] = (float)(sqr(i / 255.) * scale);
+		c[i] = (float)cos(i * M_PI / 128);
+		s[i] = (float)sin(i * M_PI / 128);
+	}
+	for (int i = 0; i < n; i++) {
+		float r = magnitude[in[i]];
+		psi[2 * i] = r * c[in[n + i]];
+		psi[2 * i + 1] = r * s[in[n + i]];
+	}
+}
+
+PsiRecorder::PsiRecorder() : finishing(false), failed(false), writing(false) {
+	open = false;
+	claimed = -1;
+	added = dropped = 0;
+	width = height = 0;
+	quant = PSI_QUANT_BYTE;
+	keyframes = 1;
+	dt = 0;
+}
+
+bool PsiRecorder::Open(const char *path, int width, int height, double dt, int quant,
+                       int keyframes, int spare) {
+	Close();
+	if (width <= 0 || height <= 0 || quant < 0 || quant >= PSI_QUANT_COUNT)
+		return false;
+	
+	this->path = path;
+	this->width = width;
+	this->height = height;
+	this->dt = dt;
+	this->quant = quant;
+	this->keyframes = max(keyframes, 1);
+	
+	spare = max(spare, 1);
+	frame.Clear();
+	frame.SetCount(spare);
+	full.Alloc(spare);
+	empty.Alloc(spare);
+	for (int i = 0; i < spare; i++)
+		empty.Put(i);
+	
+	finishing = false;
+	failed = false;
+	added = dropped = 0;
+	open = true;
+	writing = true;
+	writer.Run([=] {Write(); writing = false;});
+	return true;
+}
+
+PsiFrame *PsiRecorder::Claim() {
+	if (!open)
+		return NULL;
+	if (!empty.Get(claimed)) {
+		dropped++;
+		return NULL;
+	}
+	return &frame[claimed];
+}
+
+void PsiRecorder::Commit() {
+	full.Put(claimed);
+	wake.Release();
+	added++;
+}
+
+bool PsiRecorder::Add(const PsiFrame& src) {
+	if (src.width != width || src.height != height)
+		return false;
+	PsiFrame *f = Claim();
+	if (!f)
+		return false;
+	
+	if (f->width != width || f->height != height) {
+		f->psi.Alloc(2 * width * height);
+		f->width = width;
+		f->height = height;
+	}
+	memcpy(~f->psi, ~src.psi, 2 * width * height * sizeof(float));
+	f->step = src.step;
+	f->norm = src.norm;
+	if (f->tiles_x != src.tiles_x || f->tiles_y != src.tiles_y) {
+		f->zero.Alloc(src.tiles_x * src.tiles_y);
+		f->tiles_x = src.tiles_x;
+		f->tiles_y = src.tiles_y;
+	}
+	if (src.tiles_x)
+		memcpy(~f->zero, ~src.zero, src.tiles_x * src.tiles_y);
+	
+	Commit();
+	return true;
+}
+
+void PsiRecorder::Finish() {
+	if (!open)
+		return;
+	open = false;
+	finishing.store(true, std::memory_order_release);
+	wake.Release();
+}
+
+bool PsiRecorder::Close() {
+	Finish();
+	if (writer.IsOpen())
+		writer.Wait();
+	return !failed;
+}
+
+// Write - the writer thread: quantizes, encodes and writes the frames as
+// they come, until Finish
+void PsiRecorder::Write() {
+	// the tiles are those of the simulator, see Propagator
+	int tiles_x = GetTilesX(width);
+	int tiles_y = GetTilesY(height);
+	int cells = width * height;
+	int size = GetPlanes(quant) * cells + tiles_x * tiles_y;
+	Buffer<byte> buffer(2 * size), delta(size);
+	byte *cur = ~buffer;
+	byte *last = cur + size;
+	Vector<int64> index;
+	
+	FileOut out;
+	if (!out.Open(path))
+		failed = true;
+	else {
+		out.Put("QREC", 4);
+		out.Put32le(PSIREC_VERSION);
+		out.Put32le(width);
+		out.Put32le(height);
+		out.Put32le(quant);
+		out.Put32le(keyframes);
+		out.Put32le(tiles_x);
+		out.Put32le(tiles_y);
+		PutDouble(out, dt);
+	}
+	
+	for (;;) {
+		wake.Wait();
+		bool last_call = finishing.load(std::memory_order_acquire);
+		
+		int i;
+		while (full.Get(i)) {
+			const PsiFrame& f = frame[i];
+			if (!failed && f.width == width && f.height == height) {
+				float scale = Quantize(f, quant, cur);
+				byte *zero = cur + GetPlanes(quant) * cells;
+				if (f.tiles_x == tiles_x && f.tiles_y == tiles_y)
+					memcpy(zero, ~f.zero, tiles_x * tiles_y);
+				else
+					memset(zero, 0, tiles_x * tiles_y);
+				
+				bool key = index.GetCount() % keyframes == 0;
+				const byte *src = cur;
+				if (!key) {
+					for (int b = 0; b < size; b++)
+						delta[b] = cur[b] - last[b];
+					src = delta;
+				}
+				String packed = ZCompress(src, size);
+				
+				index.Add(out.GetPos());
+				out.Put("QFRM", 4);
+				out.Put32le(key);
+				out.Put64le(f.step);
+				PutDouble(out, f.norm);
+				PutFloat(out, scale);
+				out.Put32le(size);
+				out.Put32le(packed.GetCount());
+				out.Put(~packed, packed.GetCount());
+				
+				Swap(cur, last);
+				if (out.IsError())
+					failed = true;
+			}
+			empty.Put(i);
+		}
+		
+		if (last_call)
+			break;
+	}
+	
+	if (failed)
+		return;
+	
+	int64 pos = out.GetPos();
+	out.Put("QIDX", 4);
+	out.Put32le(index.GetCount());
+	for (int64 o : index)
+		out.Put64le(o);
+	out.Put64le(pos);
+	out.Put("QEND", 4);
+	out.Close();
+	if (out.IsError())
+		failed = true;
+}
+
+bool PsiRecording::Open(const char *path) {
+	Close();
+	if (!map.Open(path) || !map.Map(0, (size_t)map.GetFileSize()))
+		return false;
+	data = map.Begin();
+	size = map.GetFileSize();
+	
+	if (size < PSIREC_HEADER || memcmp(data, "QREC", 4) != 0 || Peek32le(data + 4) != PSIREC_VERSION) {
+		Close();
+		return false;
+	}
+	width = Peek32le(data + 8);
+	height = Peek32le(data + 12);
+	quant = Peek32le(data + 16);
+	tiles_x = Peek32le(data + 24);
+	tiles_y = Peek32le(data + 28);
+	dt = PeekDouble(data + 32);
+	if (width <= 0 || height <= 0 || quant < 0 || quant >= PSI_QUANT_COUNT || tiles_x < 0 || tiles_y < 0) {
+		Close();
+		return false;
+	}
+	
+	// the index, if the recording was closed
+	int64 pos = size >= 12 ? Peek64le(data + size - 12) : 0;
+	if (size >= PSIREC_HEADER + 20 && memcmp(data + size - 4, "QEND", 4) == 0 &&
+	    pos >= PSIREC_HEADER && pos + 8 <= size - 12 && memcmp(data + pos, "QIDX", 4) == 0) {
+		int n = Peek32le(data + pos + 4);
+		if (n >= 0 && pos + 8 + 8 * (int64)n <= size - 12)
+			for (int i = 0; i < n; i++)
+				offset.Add(Peek64le(data + pos + 8 + 8 * i));
+	}
+	
+	// otherwise the frames written in full
+	if (offset.IsEmpty())
+		for (int64 o = PSIREC_HEADER; o + PSIREC_FRAME <= size && memcmp(data + o, "QFRM", 4) == 0; ) {
+			int64 next = o + PSIREC_FRAME + Peek32le(data + o + 32);
+			if (Peek32le(data + o + 32) < 0 || next > size)
+				break;
+			offset.Add(o);
+			o = next;
+		}
+	
+	// an index pointing anywhere but at whole frames is corrupt
+	for (int64 o : offset)
+		if (o < PSIREC_HEADER || o + PSIREC_FRAME > size || memcmp(data + o, "QFRM", 4) != 0 ||
+		    Peek32le(data + o + 32) < 0 || o + PSIREC_FRAME + Peek32le(data + o + 32) > size) {
+			Close();
+			return false;
+		}
+	
+	raw.Alloc(GetPlanes(quant) * width * height + tiles_x * tiles_y);
+	current = -1;
+	return true;
+}
+
+void PsiRecording::Close() {
+	map.Close();
+	data = NULL;
+	size = 0;
+	offset.Clear();
+	current = -1;
+}
+
+int64 PsiRecording::GetStep(int i) const {
+	return Peek64le(data + offset[i] + 8);
+}
+
+bool PsiRecording::IsKeyframe(int i) const {
+	return Peek32le(data + offset[i] + 4) & 1;
+}
+
+int PsiRecording::FindStep(int64 step) const {
+	// the steps grow with the frames
+	int lo = 0, hi = GetCount();
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (GetStep(mid) <= step)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+// Decode - apply frame i to raw, which holds frame i - 1 unless i is a keyframe
+bool PsiRecording::Decode(int i) {
+	const byte *h = data + offset[i];
+	int n = Peek32le(h + 28);
+	String s = ZDecompress(h + PSIREC_FRAME, Peek32le(h + 32));
+	if (n != s.GetCount() || n != GetPlanes(quant) * width * height + tiles_x * tiles_y)
+		return false;
+	
+	const byte *p = (const byte *)~s;
+	if (IsKeyframe(i))
+		memcpy(~raw, p, n);
+	else
+		for (int b = 0; b < n; b++)
+			raw[b] += p[b];
+	return true;
+}
+
+bool PsiRecording::Read(int i, PsiFrame& frame) {
+	if (!data || i < 0 || i >= GetCount())
+		return false;
+	
+	if (i != current) {
+		int k = i;
+		while (k > 0 && !IsKeyframe(k))
+			k--;
+		int from = current >= k && current < i ? current + 1 : k;
+		current = -1;
+		for (int j = from; j <= i; j++)
+			if (!Decode(j))
+				return false;
+		current = i;
+	}
+	
+	if (frame.width != width || frame.height != height) {
+		frame.psi.Alloc(2 * width * height);
+		frame.width = width;
+		frame.height = height;
+	}
+	if (frame.tiles_x != tiles_x || frame.tiles_y != tiles_y) {
+		frame.zero.Alloc(tiles_x * tiles_y);
+		frame.tiles_x = tiles_x;
+		frame.tiles_y = tiles_y;
+	}
+	
+	const byte *h = data + offset[i];
+	frame.step = GetStep(i);
+	frame.norm = PeekDouble(h + 16);
+	
+	Dequantize(~raw, quant, PeekFloat(h + 24), frame);
+	memcpy(~frame.zero, ~raw + GetPlanes(quant) * width * height, tiles_x * tiles_y);
+	return true;
+}
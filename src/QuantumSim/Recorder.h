@@ -0,0 +1,140 @@
+#ifndef _QuantumSim_Recorder_h_
+#define _QuantumSim_Recorder_h_
+
+// Recordings (.qrec) - the psi frames of a run, quantized, each one stored as
+// the difference to the previous frame and zlib compressed, with an index for
+// seeking. All numbers are little-endian:
+//
+//   "QREC", int32 version (1), int32 width, height
+//   int32 quantization (PSI_QUANT_...), int32 keyframe interval
+//   int32 tiles_x, tiles_y        of the zero tiles, see PsiFrame
+//   double dt
+//   the frames, each one:
+//     "QFRM", int32 flags (1 = keyframe)
+//     int64 step, double norm, float scale, int32 size, int32 packed size
+//     packed size bytes inflating to size bytes: the planes of the quantized
+//     cells one after the other, then one byte per tile, 1 if it is zero.
+//     Apart from keyframes each byte is the difference to the same byte of
+//     the previous frame, modulo 256.
+//   the index:
+//     "QIDX", int32 count, count int64 offsets of the frames
+//     int64 offset of "QIDX", "QEND"
+//
+// A recording that was not closed has no index; the frames are found by
+// scanning them then.
+
+enum { PSIREC_VERSION = 1 };
+
+enum {
+	PSI_QUANT_BYTE, // 8-bit magnitude (sqrt companded, relative to the largest) and 8-bit phase
+	PSI_QUANT_HALF, // re and im as 16-bit floats
+	PSI_QUANT_COUNT
+};
+
+const char *GetQuantName(int quant);
+int         FindQuant(const char *name); // -1 if unknown
+
+// PsiRecorder - writes a recording on a thread of its own. The thread adding
+// frames only copies psi into one of a few spare frames; when the writer is
+// that far behind, the frame is dropped instead. Quantizing, compressing and
+// the disk are the writer's business, and only Open and Close wait for it.
+// Open, Add, Finish and Close are called by one thread, e.g. the one stepping.
+class PsiRecorder : NoCopy {
+public:
+	// Open - start recording frames of width x height into path, a keyframe
+	// every keyframes frames, with spare frames for the writer. The file is
+	// created by the writer. Waits for the previous recording to be written.
+	bool  Open(const char *path, int width, int height, double dt, int quant = PSI_QUANT_BYTE,
+	           int keyframes = 30, int spare = 8);
+	bool  IsOpen() const {return open;}
+	
+	// Add - psi as the next frame; false if it was dropped
+	template <class Real>
+	bool  Add(const QuantumSimulator_<Real>& sim);
+	bool  Add(const PsiFrame& frame);
+	
+	// Finish - end the recording without waiting; the writer writes the
+	// frames still queued and the index, then closes the file
+	void  Finish();
+	// Close - Finish and wait for the writer. false if writing failed.
+	bool  Close();
+	// IsWriting - whether the writer is still busy with the last recording, so
+	// Open or Close would wait for it
+	bool  IsWriting() const {return writing;}
+	
+	int64 GetFrames() const  {return added;}
+	int64 GetDropped() const {return dropped;}
+	
+	PsiRecorder();
+	~PsiRecorder() {Close();}
+
+private:
+	Array<PsiFrame>   frame;  // the spare frames
+	RingBuffer<int>   full;   // frames for the writer
+	RingBuffer<int>   empty;  // frames the writer is done with
+	Semaphore         wake;
+	Thread            writer;
+	std::atomic<bool> finishing;
+	std::atomic<bool> failed;
+	std::atomic<bool> writing;
+	bool              open;
+	int               claimed;
+	int64             added, dropped;
+	
+	String path;
+	int    width, height, quant, keyframes;
+	double dt;
+	
+	PsiFrame *Claim();
+	void      Commit();
+	void      Write();
+};
+
+// PsiRecording - a recording mapped into memory for playback
+class PsiRecording : NoCopy {
+public:
+	bool   Open(const char *path);
+	void   Close();
+	bool   IsOpen() const {return data;}
+	
+	int    GetCount() const  {return offset.GetCount();}
+	int    GetWidth() const  {return width;}
+	int    GetHeight() const {return height;}
+	int    GetQuant() const  {return quant;}
+	double GetDt() const     {return dt;}
+	int64  GetStep(int i) const;
+	bool   IsKeyframe(int i) const;
+	// FindStep - the last frame at or before step, -1 if there is none
+	int    FindStep(int64 step) const;
+	
+	// Read - frame i into frame, decoded from the keyframe before it, or from
+	// the frame read last if that is on the way
+	bool   Read(int i, PsiFrame& frame);
+	
+	PsiRecording() {data = NULL; size = 0; current = -1;}
+	~PsiRecording() {Close();}
+
+private:
+	FileMapping   map;
+	const byte   *data;
+	int64         size;
+	int           width, height, quant, tiles_x, tiles_y;
+	double        dt;
+	Vector<int64> offset;  // of each frame
+	Buffer<byte>  raw;     // the quantized planes of frame current
+	int           current;
+	
+	bool Decode(int i);
+};
+
+template <class Real>
+bool PsiRecorder::Add(const QuantumSimulator_<Real>& sim) {
+	PsiFrame *f = Claim();
+	if (!f)
+		return false;
+	sim.Snapshot(*f);
+	Commit();
+	return true;
+}
+
+#endif
@@ -0,0 +1,197 @@
+#include "QuantumSim.h"
+
+#include <plugin/bz2/bz2.h>
+#include <plugin/png/png.h>
+#include "imgs/imgs.brc"
+
+#if defined(CPU_X86) && (defined(COMPILER_GCC) || defined(COMPILER_CLANG))
+#define QSIM_SIMD
+#include <immintrin.h>
+#endif
+
+static inline int CmapIndex(float v) {
+	int c = (int)v + 128;
+	return c < 0 ? 0 : c > 240 ? 240 : c;
+}
+
+static void RenderWaveScalar(RGBA *out, const RGBA *bg, const float *psi, int n,
+                             const RGBA *cmap, int cw, int mode) {
+	for (int i = 0; i < n; i++) {
+		const RGBA& src = cmap[CmapIndex(psi[0]) * cw + CmapIndex(psi[1])];
+		RGBA c = *bg++;
+		psi += 2;
+		
+		if (mode == WAVE_SATURATE) {
+			c.r = src.r ? 255 : c.r;
+			c.g = src.g ? 255 : c.g;
+			c.b = src.b ? 255 : c.b;
+		}
+		else if (mode == WAVE_INVERT) {
+			c.r = src.r ? 0 : 255;
+			c.g = src.g ? 0 : 255;
+			c.b = src.b ? 0 : 255;
+		}
+		else {
+			c.r = min(255, (int)c.r + (int)src.r);
+			c.g = min(255, (int)c.g + (int)src.g);
+			c.b = min(255, (int)c.b + (int)src.b);
+		}
+		
+		*out++ = c;
+	}
+}
+
+#ifdef QSIM_SIMD
+
+// 8 cells per iteration: truncate, offset and clamp the 16 floats to colormap
+// coordinates, gather the 8 colormap entries and blend them with bytewise ops
+__attribute__((target("avx2")))
+static void RenderWaveAVX2(RGBA *out, const RGBA *bg, const float *psi, int n,
+                           const RGBA *cmap, int cw, int mode) {
+	const __m256i lo = _mm256_setzero_si256();
+	const __m256i hi = _mm256_set1_epi32(240);
+	const __m256i offset = _mm256_set1_epi32(128);
+	const __m256i row = _mm256_set1_epi32(cw);
+	const __m256i rgb = _mm256_set1_epi32(0x00ffffff);
+	const __m256i deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		// (re, im) pairs -> re0..re3 im0..im3 per 128-bit lane
+		__m256 a = _mm256_permutevar8x32_ps(_mm256_loadu_ps(psi + 2 * i), deinterleave);
+		__m256 b = _mm256_permutevar8x32_ps(_mm256_loadu_ps(psi + 2 * i + 8), deinterleave);
+		__m256 re = _mm256_permute2f128_ps(a, b, 0x20);
+		__m256 im = _mm256_permute2f128_ps(a, b, 0x31);
+		
+		__m256i cy = _mm256_add_epi32(_mm256_cvttps_epi32(re), offset);
+		__m256i cx = _mm256_add_epi32(_mm256_cvttps_epi32(im), offset);
+		cy = _mm256_min_epi32(_mm256_max_epi32(cy, lo), hi);
+		cx = _mm256_min_epi32(_mm256_max_epi32(cx, lo), hi);
+		
+		__m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(cy, row), cx);
+		__m256i src = _mm256_and_si256(_mm256_i32gather_epi32((const int *)cmap, idx, 4), rgb);
+		__m256i c = _mm256_loadu_si256((const __m256i *)(bg + i));
+		
+		if (mode == WAVE_SATURATE) {
+			__m256i nz = _mm256_andnot_si256(_mm256_cmpeq_epi8(src, lo), rgb);
+			c = _mm256_or_si256(c, nz);
+		}
+		else if (mode == WAVE_INVERT) {
+			__m256i z = _mm256_and_si256(_mm256_cmpeq_epi8(src, lo), rgb);
+			c = _mm256_or_si256(_mm256_andnot_si256(rgb, c), z);
+		}
+		else
+			c = _mm256_adds_epu8(c, src);
+		
+		_mm256_storeu_si256((__m256i *)(out + i), c);
+	}
+	_mm256_zeroupper();
+	RenderWaveScalar(out + i, bg + i, psi + 2 * i, n - i, cmap, cw, mode);
+}
+
+#endif
+
+void RenderWave(RGBA *out, const RGBA *bg, const float *psi, int n,
+                const Image& cmap, int mode) {
+	ASSERT(cmap.GetWidth() > 240 && cmap.GetHeight() > 240);
+	
+#ifdef QSIM_SIMD
+	static bool avx2 = __builtin_cpu_supports("avx2");
+	if (avx2 && GetSplitStepKernel() >= KERNEL_AVX2) {
+		RenderWaveAVX2(out, bg, psi, n, cmap.Begin(), cmap.GetWidth(), mode);
+		return;
+	}
+#endif
+	RenderWaveScalar(out, bg, psi, n, cmap.Begin(), cmap.GetWidth(), mode);
+}
+
+// RenderZero - what RenderWave does for n cells with psi = 0
+static void RenderZero(RGBA *out, const RGBA *bg, int n, const Image& cmap, int mode) {
+	RGBA src = cmap[128][128];
+	
+	if (mode != WAVE_INVERT && !src.r && !src.g && !src.b) {
+		memcpy(out, bg, n * sizeof(RGBA));
+		return;
+	}
+	
+	float zero[2] = {0, 0};
+	RGBA c;
+	for (int i = 0; i < n; i++) {
+		RenderWaveScalar(&c, bg + i, zero, 1, cmap.Begin(), cmap.GetWidth(), mode);
+		out[i] = c;
+	}
+}
+
+void RenderWave(RGBA *out, const RGBA *bg, const PsiFrame& frame,
+                const Image& cmap, int mode) {
+	int width = frame.width;
+	int height = frame.height;
+	
+	if (!frame.tiles_x) {
+		RenderWave(out, bg, frame.psi, width * height, cmap, mode);
+		return;
+	}
+	
+	for (int y = 0; y < height; y++) {
+		int ty = y / TILE_HEIGHT;
+		int offset = y * width;
+		
+		// runs of tiles with the same zero flag, the padding tiles are never drawn
+		for (int tx = 0; tx * TILE_WIDTH < width;) {
+			bool zero = frame.IsZeroTile(tx, ty);
+			int x0 = tx * TILE_WIDTH;
+			while (tx * TILE_WIDTH < width && frame.IsZeroTile(tx, ty) == zero)
+				tx++;
+			int n = min(tx * TILE_WIDTH, width) - x0;
+			
+			if (zero)
+				RenderZero(out + offset + x0, bg + offset + x0, n, cmap, mode);
+			else
+				RenderWave(out + offset + x0, bg + offset + x0, frame.Get(x0, y), n, cmap, mode);
+		}
+	}
+}
+
+static Image DecodeColormap(const byte *data, int length) {
+	MemReadStream mem(data, length);
+	return PNGRaster().LoadString(BZ2Decompress(mem));
+}
+
+const Image& GetWaveColormap(bool mono) {
+	static Image cmap = DecodeColormap(cmap_brc, cmap_brc_length);
+	static Image cmap_mono = DecodeColormap(cmap_mono_brc, cmap_mono_brc_length);
+	return mono ? cmap_mono : cmap;
+}
+
+Image RenderTrackBackground(const Track& track, Size grid) {
+	Size field(FIELD_WIDTH, FIELD_HEIGHT);
+	Image potential = track.potential.GetSize() == field ? track.potential : Rescale(track.potential, field);
+	const Hole& hole = track.hole;
+	
+	// the track over white, the hole black with a blue rim 2 pixels wide
+	ImageBuffer ib(field);
+	for (int y = 0; y < field.cy; y++) {
+		const RGBA *s = potential[y];
+		RGBA *t = ib[y];
+		for (int x = 0; x < field.cx; x++) {
+			double dx = x + .5 - hole.x;
+			double dy = y + .5 - hole.y;
+			double d = sqrt(dx * dx + dy * dy);
+			if (d < hole.r - 1)
+				t[x] = Black();
+			else if (d <= hole.r + 1)
+				t[x] = Color(0, 0, 255);
+			else {
+				int white = 255 - s[x].a;
+				t[x].r = (byte)min(s[x].r + white, 255);
+				t[x].g = (byte)min(s[x].g + white, 255);
+				t[x].b = (byte)min(s[x].b + white, 255);
+				t[x].a = 255;
+			}
+		}
+	}
+	ib.SetKind(IMAGE_OPAQUE);
+	
+	Image img = ib;
+	return grid != field ? Rescale(img, grid) : img;
+}
@@ -0,0 +1,34 @@
+#ifndef _QuantumSim_Render_h_
+#define _QuantumSim_Render_h_
+
+// Conversion of psi into colors, as done by the game. The real part selects
+// the row and the imaginary part the column of a 2D colormap; both are offset
+// by 128 and clamped to 0 .. 240, so the colormap must be at least 241x241.
+enum {
+	WAVE_ADD,      // background + colormap, saturated per channel
+	WAVE_SATURATE, // any non-zero colormap channel becomes 255
+	WAVE_INVERT,   // 255 where the colormap channel is zero, 0 elsewhere
+};
+
+// RenderWave - render n cells of psi ((re, im) pairs) over the background
+// bg into out. The alpha of bg is kept. Uses AVX2 when it is available.
+void RenderWave(RGBA *out, const RGBA *bg, const float *psi, int n,
+                const Image& cmap, int mode);
+
+struct PsiFrame;
+struct Track;
+
+// RenderWave - render a whole frame over bg of the same size. The tiles known
+// to be zero are filled with the color of psi = 0 without looking at psi.
+void RenderWave(RGBA *out, const RGBA *bg, const PsiFrame& frame,
+                const Image& cmap, int mode);
+
+// GetWaveColormap - the colormaps of the game, cmap_mono.png or cmap.png,
+// decoded once
+const Image& GetWaveColormap(bool mono);
+
+// RenderTrackBackground - what the wave is rendered over: the potential of
+// track on white with the hole, drawn at field size and scaled to grid
+Image RenderTrackBackground(const Track& track, Size grid);
+
+#endif
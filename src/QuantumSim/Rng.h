@@ -0,0 +1,40 @@
+#ifndef _QuantumSim_Rng_h_
+#define _QuantumSim_Rng_h_
+
+// Rng - xoshiro256** generator. Seedable per instance, so measurements can be
+// reproduced, and fast enough to draw millions of samples per wavefunction.
+class Rng {
+	uint64 s[4];
+	
+	static uint64 Rotl(uint64 x, int k) {return (x << k) | (x >> (64 - k));}
+	
+public:
+	// Seed - expand seed into the state with splitmix64
+	void Seed(uint64 seed) {
+		for (int i = 0; i < 4; i++) {
+			uint64 z = (seed += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			s[i] = z ^ (z >> 31);
+		}
+	}
+	
+	uint64 Get() {
+		uint64 r = Rotl(s[1] * 5, 7) * 9;
+		uint64 t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = Rotl(s[3], 45);
+		return r;
+	}
+	
+	// GetDouble - uniform in [0, 1)
+	double GetDouble() {return (Get() >> 11) * (1.0 / 9007199254740992.0);}
+	
+	Rng(uint64 seed = 0) {Seed(seed);}
+};
+
+#endif
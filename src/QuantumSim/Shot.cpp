@@ -0,0 +1,114 @@
+#include "QuantumSim.h"
+
+// GenGaussAt - FieldGauss for either simulator, at... selects the wave of a
+// BatchSimulator
+template <class Sim, class... At>
+static void GenGaussAt(Sim& sim, double cx, double cy, double kx, double ky, double w, At... at) {
+	double sx = (double)sim.GetWidth() / FIELD_WIDTH;
+	double sy = (double)sim.GetHeight() / FIELD_HEIGHT;
+	
+	sim.GenGauss(at..., (int)(cx * sx), (int)(cy * sy), kx / sx, ky / sy, w * sx);
+}
+
+template <class Sim, class... At>
+static void FireAt(const Shot& shot, Sim& sim, At... at) {
+	GenGaussAt(sim, shot.ballx, shot.bally,
+	           -2 * shot.v * M_PI / 2 * cos(shot.phi) / 2,
+	           -2 * shot.v * M_PI / 2 * sin(shot.phi) / 2,
+	           shot.w, at...);
+}
+
+template <class Real>
+void FieldGauss(QuantumSimulator_<Real>& sim, double cx, double cy, double kx, double ky, double w) {
+	GenGaussAt(sim, cx, cy, kx, ky, w);
+}
+
+void FieldGauss(BatchSimulator& sim, int i, double cx, double cy, double kx, double ky, double w) {
+	GenGaussAt(sim, cx, cy, kx, ky, w, i);
+}
+
+template <class Real>
+void Shot::Fire(QuantumSimulator_<Real>& sim) const {
+	FireAt(*this, sim);
+}
+
+void Shot::Fire(BatchSimulator& sim, int i) const {
+	FireAt(*this, sim, i);
+}
+
+template <class Real>
+void FireUncertainty(QuantumSimulator_<Real>& sim, int y) {
+	FieldGauss(sim, 200, y, -.4, 0, 15);
+	FieldGauss(sim, 400, y, -.4, 0, 6);
+	FieldGauss(sim, 600, y, -.4, 0, 3);
+}
+
+template <class Real>
+double RunShot(QuantumSimulator_<Real>& sim, const Shot& shot, int steps, Vector<double> *norm,
+               double stop_hole, PsiRecorder *recorder, int record_every) {
+	sim.ClearWave();
+	shot.Fire(sim);
+	
+	if (norm)
+		norm->Reserve(norm->GetCount() + steps);
+	record_every = max(record_every, 1);
+	
+	int64 t0 = usecs();
+	if (recorder)
+		recorder->Add(sim);
+	for (int i = 0; i < steps; i++) {
+		double n = sim.Step();
+		if (norm)
+			norm->Add(n);
+		if (recorder && (i + 1) % record_every == 0)
+			recorder->Add(sim);
+		if (stop_hole > 0 && sim.IsObserving() && sim.GetObservables().hole >= stop_hole)
+			break;
+	}
+	return (usecs() - t0) / 1e6;
+}
+
+template <class Real1, class Real2>
+double PsiDistance(const QuantumSimulator_<Real1>& a, const QuantumSimulator_<Real2>& b) {
+	ASSERT(a.GetSize() == b.GetSize());
+	
+	double na = 0, nb = 0;
+	for (int y = 0; y < a.GetHeight(); y++)
+		for (int x = 0; x < a.GetWidth(); x++) {
+			const Real1 *p = a.Psi(x, y);
+			const Real2 *q = b.Psi(x, y);
+			na += (double)p[0] * p[0] + (double)p[1] * p[1];
+			nb += (double)q[0] * q[0] + (double)q[1] * q[1];
+		}
+	
+	if (na <= 0 || nb <= 0)
+		return na == nb ? 0 : 1;
+	
+	double sa = 1 / sqrt(na);
+	double sb = 1 / sqrt(nb);
+	double d = 0;
+	for (int y = 0; y < a.GetHeight(); y++)
+		for (int x = 0; x < a.GetWidth(); x++) {
+			const Real1 *p = a.Psi(x, y);
+			const Real2 *q = b.Psi(x, y);
+			double re = p[0] * sa - q[0] * sb;
+			double im = p[1] * sa - q[1] * sb;
+			d += re * re + im * im;
+		}
+	return sqrt(d);
+}
+
+template void FieldGauss(QuantumSimulator& sim, double cx, double cy, double kx, double ky, double w);
+template void FieldGauss(QuantumSimulator64& sim, double cx, double cy, double kx, double ky, double w);
+template void Shot::Fire(QuantumSimulator& sim) const;
+template void Shot::Fire(QuantumSimulator64& sim) const;
+template void FireUncertainty(QuantumSimulator& sim, int y);
+template void FireUncertainty(QuantumSimulator64& sim, int y);
+template double RunShot(QuantumSimulator& sim, const Shot& shot, int steps, Vector<double> *norm, double stop_hole,
+                        PsiRecorder *recorder, int record_every);
+template double RunShot(QuantumSimulator64& sim, const Shot& shot, int steps, Vector<double> *norm, double stop_hole,
+                        PsiRecorder *recorder, int record_every);
+template double PsiDistance(const QuantumSimulator& a, const QuantumSimulator& b);
+template double PsiDistance(const QuantumSimulator& a, const QuantumSimulator64& b);
+template double PsiDistance(const QuantumSimulator64& a, const QuantumSimulator& b);
+template double PsiDistance(const QuantumSimulator64& a, const QuantumSimulator64& b);
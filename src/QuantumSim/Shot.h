@@ -0,0 +1,50 @@
+#ifndef _QuantumSim_Shot_h_
+#define _QuantumSim_Shot_h_
+
+// Shot - the parameters of a single stroke, i.e. where the ball lies and how
+// the racket hits it. Fire() sets up the wave packet exactly like the game does.
+// Positions are in field coordinates, see FIELD_WIDTH.
+struct Shot {
+	int    ballx, bally; // position of the ball
+	double phi;          // racket angle, the ball moves away from the racket
+	double v;            // club speed as fraction of the maximum, 0 .. 1
+	double w;            // width of the wave packet
+	
+	template <class Real>
+	void Fire(QuantumSimulator_<Real>& sim) const;
+	void Fire(BatchSimulator& sim, int i) const; // into wave i of the batch
+	
+	Shot() {ballx = 550; bally = 160; phi = 0; v = 1; w = 10;}
+};
+
+// FieldGauss - GenGauss with position, momentum and width given in field
+// coordinates, scaled to the grid of sim. The simulated time does not depend
+// on the grid, as the kinetic phase per step only depends on the frequency
+// index. On grids coarser than the field, fast packets get close to the
+// Nyquist limit of pi per cell (a full speed shot reaches it at 320x160).
+template <class Real>
+void FieldGauss(QuantumSimulator_<Real>& sim, double cx, double cy, double kx, double ky, double w);
+void FieldGauss(BatchSimulator& sim, int i, double cx, double cy, double kx, double ky, double w);
+
+// FireUncertainty - the packets of the uncertainty movie (070519) instead of a
+// shot: three of widths 15, 6 and 3 at height y, all with the same momentum
+template <class Real>
+void FireUncertainty(QuantumSimulator_<Real>& sim, int y);
+
+// RunShot - fire shot on the track already loaded into sim and propagate it
+// for the given number of steps as fast as possible. The norm after each step
+// is appended to norm, if given. If sim observes, see SetObservables, it stops
+// early once the hole holds stop_hole of the norm, unless that is 0. If
+// recorder is given, psi after the shot and after every record_every steps is
+// added to it. Returns the wall-clock time in seconds.
+template <class Real>
+double RunShot(QuantumSimulator_<Real>& sim, const Shot& shot, int steps, Vector<double> *norm = NULL,
+               double stop_hole = 0, PsiRecorder *recorder = NULL, int record_every = 1);
+
+// PsiDistance - relative L2 distance between the wavefunctions of a and b,
+// each normalized first, e.g. to compare a run against one with a finer
+// timestep or in double precision. Both must be on the same grid.
+template <class Real1, class Real2>
+double PsiDistance(const QuantumSimulator_<Real1>& a, const QuantumSimulator_<Real2>& b);
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _QuantumSim_Snapshot_h_
+#define _QuantumSim_Snapshot_h_
+
+// TripleBuffer - hands the latest of a stream of values from one writer
+// thread to one reader thread without locks. The writer fills Back() and
+// Publish()es it; the reader always gets the newest published value from
+// Read(). Neither side ever waits for the other.
+template <class T>
+class TripleBuffer {
+	enum { FRESH = 4 };
+	
+	T buffer[3];
+	std::atomic<int> middle; // index of the exchanged buffer, FRESH if not read yet
+	int back, front;
+	
+public:
+	T&       Back()          {return buffer[back];}
+	void     Publish()       {back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3;}
+	bool     IsFresh() const {return middle.load(std::memory_order_acquire) & FRESH;}
+	
+	const T& Read() {
+		if (IsFresh())
+			front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+		return buffer[front];
+	}
+	
+	TripleBuffer() : middle(1) {back = 0; front = 2;}
+};
+
+// RingBuffer - a queue of values from one writer thread to one reader thread
+// without locks, e.g. one value per step for live telemetry. Neither side
+// waits: once the reader has fallen a full buffer behind, Put() drops the
+// value and returns false.
+template <class T>
+class RingBuffer : NoCopy {
+	Buffer<T>          item;
+	int                mask;
+	std::atomic<int64> head;    // values put, written by the writer only
+	std::atomic<int64> tail;    // values taken, written by the reader only
+	std::atomic<int64> dropped;
+	
+public:
+	// Alloc - room for capacity values, rounded up to a power of 2. Not while
+	// either thread uses the buffer.
+	void Alloc(int capacity) {
+		int n = 1;
+		while (n < capacity)
+			n *= 2;
+		item.Alloc(n);
+		mask = n - 1;
+		head = tail = dropped = 0;
+	}
+	
+	bool Put(const T& x) {
+		int64 h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) > mask) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		item[h & mask] = x;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+	
+	bool Get(T& x) {
+		int64 t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+			return false;
+		x = item[t & mask];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	
+	int   GetCount() const   {return (int)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));}
+	int64 GetDropped() const {return dropped.load(std::memory_order_relaxed);}
+	bool  IsAllocated() const {return mask >= 0;}
+	
+	RingBuffer() : head(0), tail(0), dropped(0) {mask = -1;}
+};
+
+// PsiFrame - a read-only copy of the wavefunction for renderers and recorders
+struct PsiFrame {
+	int           width, height;
+	int64         step;   // number of steps since the shot
+	double        norm;
+	Buffer<float> psi;    // (re, im) pairs, row by row
+	int           tiles_x, tiles_y; // the tile grid of the simulator, see Propagator
+	Buffer<byte>  zero;   // per tile, psi is known to be zero all over it
+	
+	const float  *Get(int x, int y) const {return ~psi + 2 * (y * width + x);}
+	bool          IsZeroTile(int tx, int ty) const {return zero[ty * tiles_x + tx];}
+	
+	PsiFrame() {width = height = 0; step = 0; norm = 0; tiles_x = tiles_y = 0;}
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "QuantumSim.h"
+
+#include <plugin/bz2/bz2.h>
+#include <plugin/bmp/bmp.h>
+#include "imgs/imgs.brc"
+
+// DecodeBuiltinTrack - the bitmap tracks_all[i], stored BZ2 compressed
+static Image DecodeBuiltinTrack(int i) {
+	MemReadStream bmpbz2_stream(tracks_all[i], tracks_all_length[i]);
+	
+	StringStream bmp_stream;
+	
+	BZ2Decompress(bmp_stream, bmpbz2_stream);
+	
+	BMPRaster bmp;
+	
+	bmp_stream.Seek(0);
+	bmp_stream.SetLoading();
+	
+	return bmp.Load(bmp_stream);
+}
+
+void LoadBuiltinTracks(VectorMap<String, Track>& tracks) {
+	// the bitmaps do not depend on each other, so they are decoded in parallel
+	Vector<Image> img;
+	img.SetCount(tracks_all_count);
+	ForChunks(tracks_all_count, 1, CPU_Cores(), [&](int i, int, int) {
+		img[i] = DecodeBuiltinTrack(i);
+	});
+	
+	VectorMap<String, Track> course;
+	for(int i = 0; i < tracks_all_count; i++) {
+		String name = tracks_all_files[i];
+		
+		int a = name.Find(".");
+		int b = name.Find("_soft");
+		int c = name.Find("_hard");
+		bool soft = b != -1;
+		bool hard = c != -1;
+		String title = soft ? name.Left(b) : hard ? name.Left(c) : name.Left(a);
+		LOG(title << ": " << name);
+		
+		Track& t = course.GetAdd(title);
+		t.title = title;
+		if (soft)
+			t.soft = img[i];
+		else if (hard)
+			t.hard = img[i];
+		else
+			t.base = img[i];
+	}
+	
+	// each course is played on its base as it is, the variants of its layers
+	// follow it if they make a difference
+	for (int i = 0; i < course.GetCount(); i++) {
+		const Track& c = course[i];
+		int first = tracks.GetCount();
+		
+		Track& t = tracks.GetAdd(c.title);
+		t.title = c.title;
+		t.base = c.base;
+		
+		if (!c.soft.IsEmpty()) {
+			Track& s = tracks.GetAdd(c.title + "_soft");
+			s.title = c.title + "_soft";
+			s.base = c.soft;
+		}
+		
+		if (!c.hard.IsEmpty()) {
+			Track& h = tracks.GetAdd(c.title + "_hard");
+			h.title = c.title + "_hard";
+			h.base = c.base;
+			h.soft = c.soft;
+			h.hard = c.hard;
+		}
+		
+		for (int j = first; j < tracks.GetCount(); j++)
+			ComposePotential(tracks[j]);
+		
+		// at barrier 1 a track without layers is its base, bit for bit
+		ASSERT(IsSamePotential(tracks[first].potential, c.base));
+		for (int j = tracks.GetCount() - 1; j > first; j--)
+			if (IsSamePotential(tracks[j].potential, c.base))
+				tracks.Remove(j);
+	}
+}
+
+bool IsSamePotential(const Image& a, const Image& b) {
+	if (a.GetSize() != b.GetSize())
+		return false;
+	for (const RGBA *p = a.Begin(), *q = b.Begin(); p < a.End(); p++, q++)
+		if (p->r != q->r)
+			return false;
+	return true;
+}
+
+bool LoadTrackFile(const String& path, Track& track) {
+	Image img = StreamRaster::LoadFileAny(path);
+	if (img.IsEmpty())
+		return false;
+	
+	track.base = img;
+	track.soft = track.hard = Image();
+	track.title = GetFileTitle(path);
+	ComposePotential(track, track.barrier);
+	return true;
+}
+
+// ComposeRow - one row of ComposePotential, without branches so that it
+// vectorizes. A missing layer is passed as base, which leaves base as it is.
+static void ComposeRow(RGBA *t, const RGBA *base, const RGBA *soft, const RGBA *hard,
+                       int scale, int n) {
+	for (int x = 0; x < n; x++) {
+		int b = base[x].r;
+		int v = min((max(b, (int)soft[x].r) * scale + 128) >> 8, 250);
+		int wall = (b > 250) | (hard[x].r > 250);
+		byte r = (byte)(wall ? 255 : v);
+		t[x].r = t[x].g = t[x].b = r;
+		t[x].a = 255;
+	}
+}
+
+void ComposePotential(Track& track, double barrier) {
+	Size sz = track.base.GetSize();
+	track.barrier = barrier;
+	if (sz.cx <= 0 || sz.cy <= 0) {
+		track.potential = track.base;
+		return;
+	}
+	
+	Image soft = track.soft.IsEmpty() ? track.base : ResamplePotential(track.soft, sz);
+	Image hard = track.hard.IsEmpty() ? track.base : ResamplePotential(track.hard, sz);
+	int scale = (int)(minmax(barrier, 0.0, 100.0) * 256 + .5); // 1/256 steps
+	
+	ImageBuffer ib(sz);
+	for (int y = 0; y < sz.cy; y++)
+		ComposeRow(ib[y], track.base[y], soft[y], hard[y], scale, sz.cx);
+	track.potential = ib;
+}
+
+RGBA ResamplePotential(const Image& img, Size sz, int x, int y) {
+	Size isz = img.GetSize();
+	
+	int y0 = y * isz.cy / sz.cy;
+	int y1 = max((y + 1) * isz.cy / sz.cy, y0 + 1);
+	int x0 = x * isz.cx / sz.cx;
+	int x1 = max((x + 1) * isz.cx / sz.cx, x0 + 1);
+	
+	int sum[4] = {0, 0, 0, 0};
+	RGBA peak = img[y0][x0];
+	for (int j = y0; j < y1; j++) {
+		const RGBA *s = img[j];
+		for (int i = x0; i < x1; i++) {
+			sum[0] += s[i].r;
+			sum[1] += s[i].g;
+			sum[2] += s[i].b;
+			sum[3] += s[i].a;
+			if (s[i].r > peak.r)
+				peak = s[i];
+		}
+	}
+	
+	if (peak.r > 250)
+		return peak;
+	
+	int n = (x1 - x0) * (y1 - y0);
+	RGBA t;
+	t.r = sum[0] / n;
+	t.g = sum[1] / n;
+	t.b = sum[2] / n;
+	t.a = sum[3] / n;
+	return t;
+}
+
+Image ResamplePotential(const Image& img, Size sz) {
+	Size isz = img.GetSize();
+	if (isz == sz || isz.cx <= 0 || isz.cy <= 0)
+		return img;
+	
+	ImageBuffer ib(sz);
+	RGBA *t = ib.Begin();
+	
+	for (int y = 0; y < sz.cy; y++)
+		for (int x = 0; x < sz.cx; x++)
+			*t++ = ResamplePotential(img, sz, x, y);
+	
+	return ib;
+}
+
+Track ResampleTrack(const Track& track, Size sz) {
+	Track t;
+	t.title = track.title;
+	t.ball = track.ball;
+	t.hole = track.hole;
+	t.grid = track.grid;
+	t.dt = track.dt;
+	t.base = ResamplePotential(track.base, sz);
+	if (!track.soft.IsEmpty())
+		t.soft = ResamplePotential(track.soft, sz);
+	if (!track.hard.IsEmpty())
+		t.hard = ResamplePotential(track.hard, sz);
+	ComposePotential(t, track.barrier);
+	return t;
+}
+
+Size ScanGridSize(const String& s) {
+	int q = s.Find('x');
+	if (q < 0)
+		return Size(0, 0);
+	
+	int cx = StrInt(s.Left(q));
+	int cy = StrInt(s.Mid(q + 1));
+	if (IsNull(cx) || IsNull(cy) || cx < 2 || cy < 2)
+		return Size(0, 0);
+	return Size(cx, cy);
+}
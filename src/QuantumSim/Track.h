@@ -0,0 +1,71 @@
+#ifndef _QuantumSim_Track_h_
+#define _QuantumSim_Track_h_
+
+// the playing field in game coordinates. Ball and hole positions are given in
+// these units, whatever the resolution of the track bitmaps or of the grid.
+#define FIELD_WIDTH  640
+#define FIELD_HEIGHT 320
+
+// Hole - the hole of the game, in field coordinates
+struct Hole {
+	int x, y, r;
+	
+	// Contains - the win test of the game for a ball measured at (fx, fy)
+	bool Contains(int fx, int fy) const {return (fx - x) * (fx - x) + (fy - y) * (fy - y) < r * r;}
+	
+	Hole() {x = 100; y = 160; r = 30;}
+};
+
+// Track - the playing field. base holds the potential in its red channel,
+// soft and hard are optional layers over it: soft adds finite barriers, hard
+// adds absorbing walls. potential is what the simulator runs on, see
+// ComposePotential.
+struct Track : Moveable<Track> {
+	Image base, soft, hard;
+	Image potential;
+	double barrier;   // scale of the finite barriers in potential
+	String title;
+	Point  ball;      // where the ball lies at the start, field coordinates
+	Hole   hole;
+	// recommended by track packs, used by the CLI and the movies. The game
+	// plays every track on its own grid and timestep (-grid, -dt).
+	Size   grid;      // recommended simulation grid, (0, 0) for the bitmap size
+	double dt;        // recommended timestep, 0 for the default
+	
+	Track() {barrier = 1; ball = Point(550, 160); grid = Size(0, 0); dt = 0;}
+};
+
+// ComposePotential - combine the layers of track into track.potential: the
+// walls (red > 250) of base and hard absorb, elsewhere the higher of base and
+// soft is the barrier, scaled by barrier and capped below the walls at 250.
+// Tracks without layers get base with its barriers scaled.
+void ComposePotential(Track& track, double barrier = 1);
+
+// LoadBuiltinTracks - decode the tracks compiled into imgs/imgs.brc. A course
+// plays on its base bitmap. Its layers, the bitmaps name_soft and name_hard,
+// come as tracks of their own where they change the potential: name_soft is
+// the soft layer alone, the finite barriers without any walls, and name_hard
+// is base with both layers composed, i.e. with the walls of the hard layer.
+void LoadBuiltinTracks(VectorMap<String, Track>& tracks);
+
+// IsSamePotential - whether a and b have the same size and red channel, so the
+// simulator sees the same track
+bool IsSamePotential(const Image& a, const Image& b);
+
+// LoadTrackFile - load a potential bitmap from disk as the base of a track
+bool LoadTrackFile(const String& path, Track& track);
+
+// ResamplePotential - scale a potential bitmap to sz. A pixel gets the mean of
+// the source pixels it covers, or the reddest of them if that one is a wall
+// (red > 250), so thin walls still absorb after downsampling.
+Image ResamplePotential(const Image& img, Size sz);
+// the pixel (x, y) of ResamplePotential(img, sz) alone
+RGBA  ResamplePotential(const Image& img, Size sz, int x, int y);
+
+// ResampleTrack - resample all layers of a track to the grid size sz
+Track ResampleTrack(const Track& track, Size sz);
+
+// ScanGridSize - parse a grid size given as "<width>x<height>", Size(0, 0) if invalid
+Size ScanGridSize(const String& s);
+
+#endif
@@ -0,0 +1,230 @@
+#include "QuantumSim.h"
+
+#define PACK_HEADER 16
+#define PACK_ENTRY  128
+#define PACK_ALIGN  64
+
+bool TrackPack::Open(const char *path) {
+	Close();
+	
+	if (!map.Open(path) || map.GetFileSize() < PACK_HEADER || !map.Map(0, (size_t)map.GetFileSize())) {
+		map.Close();
+		return false;
+	}
+	
+	const byte *p = map.Begin();
+	int n = Peek32le(p + 8);
+	if (memcmp(p, "QTRK", 4) != 0 || Peek32le(p + 4) != TRACKPACK_VERSION ||
+	    n < 0 || PACK_HEADER + (int64)n * PACK_ENTRY > map.GetFileSize()) {
+		map.Close();
+		return false;
+	}
+	
+	data = p;
+	size = map.GetFileSize();
+	count = n;
+	return true;
+}
+
+void TrackPack::Close() {
+	map.Close();
+	data = NULL;
+	size = 0;
+	count = 0;
+}
+
+const byte *TrackPack::GetEntry(int i) const {
+	ASSERT(i >= 0 && i < count);
+	return data + PACK_HEADER + (int64)i * PACK_ENTRY;
+}
+
+const byte *TrackPack::GetBlock(int64 offset, int64 len) const {
+	if (offset < PACK_HEADER || len < 0 || offset + len > size)
+		return NULL;
+	return data + offset;
+}
+
+String TrackPack::GetTitle(int i) const {
+	const char *s = (const char *)GetEntry(i);
+	return String(s, (int)strnlen(s, 32));
+}
+
+static double PeekDouble(const byte *p) {
+	int64 bits = Peek64le(p);
+	double x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+Image TrackPack::GetLayer(int64 offset, Size sz) const {
+	const byte *s = offset ? GetBlock(offset, (int64)sz.cx * sz.cy) : NULL;
+	if (!s)
+		return Image();
+	
+	ImageBuffer ib(sz);
+	RGBA *t = ib.Begin();
+	for (int i = 0; i < sz.cx * sz.cy; i++) {
+		t[i].r = t[i].g = t[i].b = s[i];
+		t[i].a = 255;
+	}
+	return ib;
+}
+
+bool TrackPack::Get(int i, Track& track) const {
+	const byte *e = GetEntry(i);
+	Size sz(Peek32le(e + 32), Peek32le(e + 36));
+	if (sz.cx <= 0 || sz.cy <= 0)
+		return false;
+	
+	track.title = GetTitle(i);
+	track.ball = Point(Peek32le(e + 40), Peek32le(e + 44));
+	track.hole.x = Peek32le(e + 48);
+	track.hole.y = Peek32le(e + 52);
+	track.hole.r = Peek32le(e + 56);
+	track.grid = Size(Peek32le(e + 60), Peek32le(e + 64));
+	track.dt = PeekDouble(e + 72);
+	
+	track.base = GetLayer(Peek64le(e + 88), sz);
+	track.soft = GetLayer(Peek64le(e + 96), sz);
+	track.hard = GetLayer(Peek64le(e + 104), sz);
+	if (track.base.IsEmpty())
+		return false;
+	
+	ComposePotential(track, PeekDouble(e + 80));
+	return true;
+}
+
+void TrackPack::Load(VectorMap<String, Track>& tracks) const {
+	for (int i = 0; i < count; i++) {
+		Track t;
+		if (Get(i, t))
+			tracks.GetAdd(t.title) = t;
+	}
+}
+
+const byte *TrackPack::GetPotential(int i, Size grid, int stride) const {
+	const byte *e = GetEntry(i);
+	Size g(Peek32le(e + 60), Peek32le(e + 64));
+	if (g.cx <= 0 || g.cy <= 0)
+		g = Size(Peek32le(e + 32), Peek32le(e + 36));
+	int64 offset = Peek64le(e + 112);
+	
+	if (!offset || g != grid || Peek32le(e + 68) != stride)
+		return NULL;
+	return GetBlock(offset, (int64)stride * grid.cy);
+}
+
+static void PutDouble(Stream& out, double x) {
+	int64 bits;
+	memcpy(&bits, &x, sizeof(bits));
+	out.Put64le(bits);
+}
+
+// PutLayer - the red values of a layer, resampled to the size of the track
+static void PutLayer(Stream& out, const Image& img, Size sz) {
+	Image m = ResamplePotential(img, sz);
+	Buffer<byte> row(sz.cx);
+	for (int y = 0; y < sz.cy; y++) {
+		const RGBA *s = m[y];
+		for (int x = 0; x < sz.cx; x++)
+			row[x] = s[x].r;
+		out.Put(~row, sz.cx);
+	}
+}
+
+static int64 Align(int64 offset) {
+	return (offset + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+bool SaveTrackPack(const char *path, const VectorMap<String, Track>& tracks, bool potentials) {
+	FileOut out(path);
+	if (!out)
+		return false;
+	
+	int n = tracks.GetCount();
+	
+	// the potentials as the propagator keeps them; the cells do not depend on dt
+	Array<Propagator> built;
+	Vector<const Propagator *> prop;
+	for (int i = 0; i < n; i++) {
+		const Track& t = tracks[i];
+		Size g = t.grid.cx > 0 ? t.grid : t.base.GetSize();
+		const Propagator *p = NULL;
+		if (potentials && !t.potential.IsEmpty()) {
+			Propagator& q = built.Add(new Propagator(g.cx, g.cy, t.dt > 0 ? t.dt : 1));
+			q.BuildPosition(t.potential);
+			p = &q;
+		}
+		prop.Add(p);
+	}
+	
+	// the offsets of the data blocks, in the order they are written
+	Vector<int64> offset;
+	int64 pos = Align(PACK_HEADER + (int64)n * PACK_ENTRY);
+	for (int i = 0; i < n; i++) {
+		const Track& t = tracks[i];
+		int64 layer = (int64)t.base.GetWidth() * t.base.GetHeight();
+		offset.Add(pos);
+		pos = Align(pos + layer);
+		offset.Add(t.soft.IsEmpty() ? 0 : pos);
+		pos = t.soft.IsEmpty() ? pos : Align(pos + layer);
+		offset.Add(t.hard.IsEmpty() ? 0 : pos);
+		pos = t.hard.IsEmpty() ? pos : Align(pos + layer);
+		offset.Add(prop[i] ? pos : 0);
+		pos = prop[i] ? Align(pos + (int64)prop[i]->stride * prop[i]->height) : pos;
+	}
+	
+	out.Put("QTRK", 4);
+	out.Put32le(TRACKPACK_VERSION);
+	out.Put32le(n);
+	out.Put32le(0);
+	
+	for (int i = 0; i < n; i++) {
+		const Track& t = tracks[i];
+		char title[32] = {0};
+		strncpy(title, ~t.title, sizeof(title));
+		out.Put(title, sizeof(title));
+		out.Put32le(t.base.GetWidth());
+		out.Put32le(t.base.GetHeight());
+		out.Put32le(t.ball.x);
+		out.Put32le(t.ball.y);
+		out.Put32le(t.hole.x);
+		out.Put32le(t.hole.y);
+		out.Put32le(t.hole.r);
+		out.Put32le(t.grid.cx);
+		out.Put32le(t.grid.cy);
+		out.Put32le(prop[i] ? prop[i]->stride : 0);
+		PutDouble(out, t.dt);
+		PutDouble(out, t.barrier);
+		for (int k = 0; k < 4; k++)
+			out.Put64le(offset[4 * i + k]);
+		out.Put64le(0);
+	}
+	
+	int64 written = PACK_HEADER + (int64)n * PACK_ENTRY;
+	auto Pad = [&](int64 to) {
+		for (; written < to; written++)
+			out.Put(0);
+	};
+	
+	for (int i = 0; i < n; i++) {
+		const Track& t = tracks[i];
+		Size sz = t.base.GetSize();
+		const Image *layer[3] = {&t.base, &t.soft, &t.hard};
+		for (int k = 0; k < 3; k++)
+			if (offset[4 * i + k]) {
+				Pad(offset[4 * i + k]);
+				PutLayer(out, *layer[k], sz);
+				written += (int64)sz.cx * sz.cy;
+			}
+		if (prop[i]) {
+			int64 len = (int64)prop[i]->stride * prop[i]->height;
+			Pad(offset[4 * i + 3]);
+			out.Put(prop[i]->potential, (int)len);
+			written += len;
+		}
+	}
+	
+	out.Close();
+	return !out.IsError();
+}
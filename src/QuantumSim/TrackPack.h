@@ -0,0 +1,63 @@
+#ifndef _QuantumSim_TrackPack_h_
+#define _QuantumSim_TrackPack_h_
+
+// Track packs - libraries of tracks in one binary file, loaded without
+// decompressing or decoding anything. All numbers are little-endian:
+//
+//   "QTRK", int32 version (1), int32 count, int32 0
+//   count entries of 128 bytes:
+//     char   title[32]          zero padded
+//     int32  width, height      of the layers
+//     int32  ballx, bally       field coordinates
+//     int32  holex, holey, holer
+//     int32  gridx, gridy       recommended grid, 0 for the layer size
+//     int32  stride             cells per row of the potential, 0 if none
+//     double dt                 recommended timestep, 0 for the default
+//     double barrier            see ComposePotential
+//     int64  base, soft, hard   offsets of width * height red values, 0 if missing
+//     int64  potential          offset of the composed potential at the grid,
+//                               stride * gridy cells as Propagator::potential, 0 if none
+//     8 bytes padding
+//   the data, each block aligned to 64 bytes
+
+enum { TRACKPACK_VERSION = 1 };
+
+// TrackPack - a track pack mapped into memory
+class TrackPack : NoCopy {
+public:
+	bool   Open(const char *path);
+	void   Close();
+	bool   IsOpen() const {return data;}
+	
+	int    GetCount() const {return count;}
+	String GetTitle(int i) const;
+	
+	// Get - track i, with its layers copied out of the file
+	bool   Get(int i, Track& track) const;
+	// Load - all tracks, replacing those of the same title
+	void   Load(VectorMap<String, Track>& tracks) const;
+	
+	// GetPotential - the precomputed potential of track i for
+	// QuantumSimulator::SetPotential, if the pack has one for this grid and
+	// stride, otherwise NULL. It points into the file and is valid until Close.
+	const byte *GetPotential(int i, Size grid, int stride) const;
+	
+	TrackPack() {data = NULL; size = 0; count = 0;}
+	~TrackPack() {Close();}
+	
+private:
+	FileMapping map;
+	const byte *data;
+	int64       size;
+	int         count;
+	
+	const byte *GetEntry(int i) const;
+	const byte *GetBlock(int64 offset, int64 len) const; // NULL if out of the file
+	Image       GetLayer(int64 offset, Size sz) const;
+};
+
+// SaveTrackPack - write tracks into a pack, with their composed potential at
+// the recommended grid if potentials is set
+bool SaveTrackPack(const char *path, const VectorMap<String, Track>& tracks, bool potentials = true);
+
+#endif
@@ -0,0 +1,116 @@
+#include "QuantumSim.h"
+
+template <class Real>
+static double HoleProbability(const Real (*psi)[2], int width, int height, int stride,
+                              const Hole& hole) {
+	// the rows and columns that can map into the hole, with a cell to spare
+	int y0 = max((hole.y - hole.r) * height / FIELD_HEIGHT - 1, 0);
+	int y1 = min((hole.y + hole.r) * height / FIELD_HEIGHT + 2, height);
+	int x0 = max((hole.x - hole.r) * width / FIELD_WIDTH - 1, 0);
+	int x1 = min((hole.x + hole.r) * width / FIELD_WIDTH + 2, width);
+	
+	double total = 0, in = 0;
+	for (int y = 0; y < height; y++) {
+		const Real (*row)[2] = psi + y * stride;
+		bool hit = y >= y0 && y < y1;
+		int fy = y * FIELD_HEIGHT / height;
+		
+		for (int x = 0; x < width; x++) {
+			double p = (double)row[x][0] * row[x][0] + (double)row[x][1] * row[x][1];
+			total += p;
+			// same grid to field conversion as MinigolfDrawer::StopMoving
+			if (hit && x >= x0 && x < x1 && hole.Contains(x * FIELD_WIDTH / width, fy))
+				in += p;
+		}
+	}
+	
+	return total > 0 ? in / total : 0;
+}
+
+template <class Real>
+double HoleProbability(const QuantumSimulator_<Real>& sim, const Hole& hole) {
+	return HoleProbability(sim.psi, sim.GetWidth(), sim.GetHeight(), sim.GetStride(), hole);
+}
+
+template double HoleProbability(const QuantumSimulator& sim, const Hole& hole);
+template double HoleProbability(const QuantumSimulator64& sim, const Hole& hole);
+
+double HoleProbability(const BatchSimulator& sim, int i, const Hole& hole) {
+	return HoleProbability(sim.GetPsi(i), sim.GetWidth(), sim.GetHeight(), sim.GetStride(), hole);
+}
+
+WinSweep::WinSweep() {
+	Shot shot;
+	ballx = shot.ballx;
+	bally = shot.bally;
+	w = shot.w;
+	angle0 = -M_PI / 4;
+	angle1 = M_PI / 4;
+	angles = 9;
+	speed0 = 0.2;
+	speed1 = 1;
+	speeds = 9;
+	threads = 0;
+	batch = 1;
+	integrator = INTEGRATOR_LIE;
+}
+
+void ComputeWinMap(WinMap& map, const Track& track, Size grid, double dt, const WinSweep& sweep) {
+	Propagator prop(grid.cx, grid.cy, dt);
+	prop.BuildPosition(track.potential);
+	prop.SetIntegrator(sweep.integrator);
+	
+	int shots = sweep.angles * sweep.speeds;
+	map.angles = sweep.angles;
+	map.speeds = sweep.speeds;
+	map.times = sweep.times.GetCount();
+	map.p.SetCount(shots * map.times, 0);
+	
+	if (shots <= 0 || map.times == 0)
+		return;
+	
+	// smaller batches when there are not enough shots to keep every worker busy
+	int threads = sweep.threads > 0 ? sweep.threads : CPU_Cores();
+	int batch = max(min(sweep.batch, (shots + threads - 1) / threads), 1);
+	int batches = (shots + batch - 1) / batch;
+	
+	Atomic next(0);
+	auto worker = [&] {
+		BatchSimulator sim(grid.cx, grid.cy, dt, batch);
+		sim.SetPropagator(prop);
+		
+		for (int b = next++; b < batches; b = next++) {
+			int first = b * batch;
+			int n = min(batch, shots - first);
+			
+			for (int j = 0; j < batch; j++) {
+				sim.ClearWave(j);
+				if (j >= n)
+					continue;
+				
+				int i = first + j;
+				Shot shot;
+				shot.ballx = sweep.ballx;
+				shot.bally = sweep.bally;
+				shot.w = sweep.w;
+				shot.phi = sweep.GetAngle(i / sweep.speeds);
+				shot.v = sweep.GetSpeed(i % sweep.speeds);
+				shot.Fire(sim, j);
+			}
+			
+			int t = 0;
+			for (int k = 0; k < map.times; k++) {
+				for (; t < sweep.times[k]; t++)
+					sim.Step();
+				for (int j = 0; j < n; j++)
+					map.p[(first + j) * map.times + k] = HoleProbability(sim, j, sweep.hole);
+			}
+		}
+	};
+	
+	CoWork co;
+	for (int i = 1; i < min(threads, batches); i++)
+		co & worker;
+	worker();
+	co.Finish();
+}
@@ -0,0 +1,48 @@
+#ifndef _QuantumSim_WinMap_h_
+#define _QuantumSim_WinMap_h_
+
+// HoleProbability - the chance that a position measurement on sim wins:
+// |psi|^2 summed over the cells the game counts as in the hole, divided by
+// |psi|^2 summed over the grid
+template <class Real>
+double HoleProbability(const QuantumSimulator_<Real>& sim, const Hole& hole);
+double HoleProbability(const BatchSimulator& sim, int i, const Hole& hole);
+
+// WinSweep - the shots of a win probability map. Every combination of
+// angles x speeds is fired from the ball position and measured after each
+// of the step counts in times.
+struct WinSweep {
+	int    ballx, bally;   // field coordinates
+	double w;              // width of the wave packet
+	double angle0, angle1; // racket angle in radians, see Shot::phi
+	int    angles;
+	double speed0, speed1; // club speed, see Shot::v
+	int    speeds;
+	Vector<int> times;     // ascending step counts
+	Hole   hole;
+	int    threads;        // 0 = all cores
+	int    batch;          // shots stepped together by each worker, see BatchSimulator
+	int    integrator;     // INTEGRATOR_LIE ..
+	
+	double GetAngle(int i) const {return angles > 1 ? angle0 + (angle1 - angle0) * i / (angles - 1) : angle0;}
+	double GetSpeed(int i) const {return speeds > 1 ? speed0 + (speed1 - speed0) * i / (speeds - 1) : speed0;}
+	
+	WinSweep();
+};
+
+// WinMap - probability of a win per angle, speed and time of a sweep
+struct WinMap {
+	int angles, speeds, times;
+	Vector<double> p;
+	
+	double Get(int angle, int speed, int time) const {return p[(angle * speeds + speed) * times + time];}
+	
+	WinMap() {angles = speeds = times = 0;}
+};
+
+// ComputeWinMap - run the shots of sweep on track at the given grid and
+// timestep. The shots run in parallel, one batch of shots per worker, and
+// all workers step with one shared propagator.
+void ComputeWinMap(WinMap& map, const Track& track, Size grid, double dt, const WinSweep& sweep);
+
+#endif
@@ -0,0 +1,385 @@
+#include <QuantumSim/QuantumSim.h>
+
+#ifdef PLATFORM_LINUX
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// QuantumSimBench - time the hot paths of the simulator and the renderer at
+// several grid sizes and thread counts. Writes one CSV line per path, grid and
+// thread count, so that the runs of two releases can be compared.
+
+static void Usage() {
+	Cout() << "Usage: QuantumSimBench [options]\n"
+	          "  -grids <w>x<h>,...       grid sizes (default: 320x160,640x320,1280x640)\n"
+	          "  -threads <n>,...         thread counts, 0 = all cores (default: 1,0)\n"
+	          "  -paths <name>,...        only these paths (default: all, see below)\n"
+	          "  -time <s>                minimal time per measurement (default: 0.2)\n"
+	          "  -track <name|file.bmp>   built-in track or potential bitmap (default: doubleslit)\n"
+	          "  -idle <eps>              see QuantumMinigolfCli (default: 0, every tile off the walls)\n"
+	          "  -plan <rigor>            FFTW planning: estimate, measure (default), patient, exhaustive\n"
+	          "  -perf                    read cycles, instructions and cache misses of the main thread\n"
+	          "  -o <file>                write the CSV there instead of to the standard output\n"
+	          "paths: fft, ifft, PropagateMomentum, PropagatePosition, Step, StepObserved,\n"
+	          "       BuildPositionPropagator, BuildMomentumPropagator, GenGauss, PositionMeasurement,\n"
+	          "       Snapshot, RenderWave\n";
+}
+
+enum { COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_CACHE_MISSES, COUNTER_COUNT };
+
+// PerfCounters - hardware counters of the calling thread via perf_event_open.
+// Worker threads are not counted, so with more than one thread the counts
+// only cover the share of the main thread.
+struct PerfCounters {
+	int   fd[COUNTER_COUNT];
+	int64 value[COUNTER_COUNT];
+	
+	bool Open();
+	void Close();
+	bool IsOpen() const {return fd[0] >= 0;}
+	void Reset();
+	void Enable(bool b);
+	void Read();
+	
+	PerfCounters() {for (int i = 0; i < COUNTER_COUNT; i++) fd[i] = -1;}
+	~PerfCounters() {Close();}
+};
+
+bool PerfCounters::Open() {
+#ifdef PLATFORM_LINUX
+	static const uint64 config[COUNTER_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+	};
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config[i];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (fd[i] < 0) {
+			Close();
+			return false;
+		}
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void PerfCounters::Close() {
+#ifdef PLATFORM_LINUX
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		if (fd[i] >= 0) {
+			close(fd[i]);
+			fd[i] = -1;
+		}
+#endif
+}
+
+void PerfCounters::Reset() {
+#ifdef PLATFORM_LINUX
+	for (int i = 0; i < COUNTER_COUNT && IsOpen(); i++)
+		ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+#endif
+}
+
+void PerfCounters::Enable(bool b) {
+#ifdef PLATFORM_LINUX
+	for (int i = 0; i < COUNTER_COUNT && IsOpen(); i++)
+		ioctl(fd[i], b ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+void PerfCounters::Read() {
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		value[i] = -1;
+#ifdef PLATFORM_LINUX
+		int64 v;
+		if (IsOpen() && read(fd[i], &v, sizeof(v)) == sizeof(v))
+			value[i] = v;
+#endif
+	}
+}
+
+static PerfCounters counters;
+static double       min_time = 0.2;
+
+// Result - one measurement. bytes is the memory traffic of one call as far as
+// the path itself goes, psi read and written once per pass; caches make the
+// real figure lower, FFTW's passes higher.
+struct Result {
+	String path;
+	Size   grid;
+	int    threads;
+	int64  calls;
+	double seconds;
+	double bytes;
+	int64  counter[COUNTER_COUNT];
+};
+
+// Measure - call fn until min_time has passed, in batches of BATCH calls after
+// each of which restore puts the state back without being timed. Paths like
+// the FFTs scale psi with every call and would overflow otherwise.
+enum { BATCH = 4 };
+
+template <class F, class R>
+static Result Measure(const char *path, Size grid, int threads, double bytes, F fn, R restore) {
+	restore();
+	fn(); // warm up caches and plans
+	
+	Result r;
+	r.path = path;
+	r.grid = grid;
+	r.threads = threads;
+	r.bytes = bytes;
+	r.calls = 0;
+	r.seconds = 0;
+	
+	counters.Reset();
+	while (r.seconds < min_time || r.calls < BATCH) {
+		restore();
+		counters.Enable(true);
+		int64 t0 = usecs();
+		for (int i = 0; i < BATCH; i++)
+			fn();
+		r.seconds += (usecs() - t0) / 1e6;
+		counters.Enable(false);
+		r.calls += BATCH;
+	}
+	counters.Read();
+	for (int i = 0; i < COUNTER_COUNT; i++)
+		r.counter[i] = counters.value[i];
+	return r;
+}
+
+static String FormatResult(const Result& r) {
+	double cells = (double)r.grid.cx * r.grid.cy;
+	double call = r.seconds / r.calls;
+	String s;
+	s << r.path << ',' << r.grid.cx << ',' << r.grid.cy << ',' << r.threads << ','
+	  << GetSplitStepKernelName(GetSplitStepKernel()) << ',' << r.calls << ','
+	  << Format("%.1f", call * 1e9) << ',' << Format("%.4f", call * 1e9 / cells) << ','
+	  << Format("%.3f", r.bytes / call / 1e9) << ',' << Format("%.2f", 1 / call) << ',';
+	if (r.counter[COUNTER_CYCLES] >= 0)
+		s << Format("%.3f", r.counter[COUNTER_CYCLES] / (r.calls * cells)) << ','
+		  << Format("%.3f", (double)r.counter[COUNTER_INSTRUCTIONS] / max(r.counter[COUNTER_CYCLES], (int64)1)) << ','
+		  << Format("%.5f", r.counter[COUNTER_CACHE_MISSES] / (r.calls * cells));
+	else
+		s << ",,";
+	return s;
+}
+
+// ColorMap - a smooth colormap of the size RenderWave needs; the game's own
+// costs the same to look up
+static Image ColorMap() {
+	ImageBuffer ib(256, 256);
+	for (int y = 0; y < 256; y++)
+		for (int x = 0; x < 256; x++) {
+			RGBA& c = ib[y][x];
+			c.r = (byte)y;
+			c.g = (byte)x;
+			c.b = (byte)((x + y) / 2);
+			c.a = 255;
+		}
+	return ib;
+}
+
+// Run - measure the paths at one grid size and thread count
+static int Run(const Index<String>& paths, const Track& field, Size grid, int threads, double idle,
+               Stream& out) {
+	Track track = ResampleTrack(field, grid);
+	int cells = grid.cx * grid.cy;
+	
+	QuantumSimulator sim(grid.cx, grid.cy, 0.0001, threads);
+	sim.BuildPositionPropagator(track.potential);
+	sim.SetIdleThreshold(idle);
+	
+	// a shot spread out over the track, as the game sees it most of the time
+	Shot shot;
+	RunShot(sim, shot, 200);
+	
+	int n = sim.GetStride() * grid.cy;
+	Buffer<fftwf_complex> saved(n);
+	memcpy(~saved, sim.psi, sizeof(fftwf_complex) * n);
+	auto restore = [&] { memcpy(sim.psi, ~saved, sizeof(fftwf_complex) * n); };
+	auto none = [] {};
+	
+	fftwf_plan fft, ifft;
+	PlanFftw(grid.cx, grid.cy, sim.GetStride(), threads, sim.psi, fft, ifft);
+	
+	PsiFrame frame;
+	sim.Snapshot(frame);
+	Image cmap = ColorMap();
+	Buffer<RGBA> bg(cells), wave(cells);
+	Fill(~bg, White(), cells);
+	
+	double psi = sizeof(fftwf_complex) * (double)cells;
+	int x, y;
+	int count = 0;
+	
+	auto Add = [&](const Result& r) {
+		out << FormatResult(r) << '\n';
+		out.Flush();
+		Cerr() << Format("%-24s %5dx%-5d %2d threads: %8.3f ns/cell\n", ~r.path, grid.cx, grid.cy,
+		                 threads, r.seconds / r.calls * 1e9 / cells);
+		count++;
+	};
+	
+	auto Want = [&](const char *path) {return paths.GetCount() == 0 || paths.Find(path) >= 0;};
+	
+	if (Want("fft"))
+		Add(Measure("fft", grid, threads, 2 * psi, [&] {fftwf_execute(fft);}, restore));
+	if (Want("ifft"))
+		Add(Measure("ifft", grid, threads, 2 * psi, [&] {fftwf_execute(ifft);}, restore));
+	if (Want("PropagateMomentum"))
+		Add(Measure("PropagateMomentum", grid, threads, 6 * psi, [&] {sim.PropagateMomentum();}, restore));
+	if (Want("PropagatePosition")) // quench 1 keeps psi as it is, apart from the walls
+		Add(Measure("PropagatePosition", grid, threads, 2 * psi + cells, [&] {sim.PropagatePosition(1);}, restore));
+	if (Want("Step"))
+		Add(Measure("Step", grid, threads, 8 * psi + cells, [&] {sim.Step();}, restore));
+	if (Want("StepObserved")) { // the observables fused into the passes of Step
+		sim.SetObservables(true);
+		sim.SetObservedHole(track.hole);
+		Add(Measure("StepObserved", grid, threads, 8 * psi + cells, [&] {sim.Step();}, restore));
+		sim.SetObservables(false);
+	}
+	if (Want("BuildPositionPropagator"))
+		Add(Measure("BuildPositionPropagator", grid, threads, 5. * cells,
+		            [&] {sim.BuildPositionPropagator(track.potential);}, none));
+	if (Want("BuildMomentumPropagator"))
+		Add(Measure("BuildMomentumPropagator", grid, threads, sizeof(fftwf_complex) * (grid.cx + grid.cy),
+		            [&] {sim.BuildMomentumPropagator();}, none));
+	if (Want("GenGauss"))
+		Add(Measure("GenGauss", grid, threads, psi, [&] {sim.ClearWave(); shot.Fire(sim);}, none));
+	if (Want("PositionMeasurement")) {
+		restore();
+		Add(Measure("PositionMeasurement", grid, threads, 3 * psi, [&] {sim.PositionMeasurement(&x, &y);}, none));
+	}
+	if (Want("Snapshot")) {
+		restore();
+		Add(Measure("Snapshot", grid, threads, 2 * psi, [&] {sim.Snapshot(frame);}, none));
+	}
+	if (Want("RenderWave"))
+		Add(Measure("RenderWave", grid, threads, psi + 8. * cells,
+		            [&] {RenderWave(~wave, ~bg, frame, cmap, WAVE_ADD);}, none));
+	
+	DestroyFftw(fft, ifft);
+	return count;
+}
+
+CONSOLE_APP_MAIN
+{
+	const Vector<String>& cmd = CommandLine();
+	
+	Vector<Size> grids;
+	Vector<int> threads;
+	Index<String> paths;
+	String track_name = "doubleslit";
+	String out_path;
+	double idle = 0;
+	bool perf = false;
+	
+	for (int i = 0; i < cmd.GetCount(); i++) {
+		String opt = cmd[i];
+		if (opt == "-perf") {
+			perf = true;
+			continue;
+		}
+		if (i + 1 >= cmd.GetCount()) {
+			Usage();
+			SetExitCode(1);
+			return;
+		}
+		String val = cmd[++i];
+		if (opt == "-grids") {
+			for (const String& g : Split(val, ',')) {
+				Size sz = ScanGridSize(g);
+				if (sz.cx <= 0) {
+					Usage();
+					SetExitCode(1);
+					return;
+				}
+				grids.Add(sz);
+			}
+		}
+		else if (opt == "-threads") {
+			for (const String& t : Split(val, ','))
+				threads.Add(StrInt(t));
+		}
+		else if (opt == "-paths") {
+			for (const String& p : Split(val, ','))
+				paths.FindAdd(p);
+		}
+		else if (opt == "-time")  min_time = StrDbl(val);
+		else if (opt == "-track") track_name = val;
+		else if (opt == "-idle")  idle = StrDbl(val);
+		else if (opt == "-o")     out_path = val;
+		else if (opt == "-plan") {
+			unsigned flags = FindFftwPlanning(val);
+			if (flags == (unsigned)-1) {
+				Usage();
+				SetExitCode(1);
+				return;
+			}
+			SetFftwPlanning(flags);
+		}
+		else {
+			Usage();
+			SetExitCode(1);
+			return;
+		}
+	}
+	
+	if (grids.IsEmpty()) {
+		grids.Add(Size(320, 160));
+		grids.Add(Size(640, 320));
+		grids.Add(Size(1280, 640));
+	}
+	if (threads.IsEmpty()) {
+		threads.Add(1);
+		threads.Add(0);
+	}
+	
+	VectorMap<String, Track> tracks;
+	LoadBuiltinTracks(tracks);
+	
+	Track track;
+	int q = tracks.Find(track_name);
+	if (q >= 0)
+		track = tracks[q];
+	else if (!LoadTrackFile(track_name, track)) {
+		// no walls at all, e.g. without the built-in tracks
+		ImageBuffer ib(FIELD_WIDTH, FIELD_HEIGHT);
+		Fill(ib.Begin(), Black(), ib.GetLength());
+		track.base = ib;
+		ComposePotential(track);
+		Cerr() << "Unknown track " << track_name << ", using a flat one\n";
+	}
+	
+	if (perf && !counters.Open())
+		Cerr() << "Hardware counters are not available\n";
+	
+	FileOut file;
+	if (!IsNull(out_path) && !file.Open(out_path)) {
+		Cerr() << "Cannot write " << out_path << '\n';
+		SetExitCode(1);
+		return;
+	}
+	Stream& out = IsNull(out_path) ? (Stream&)Cout() : (Stream&)file;
+	
+	out << "path,width,height,threads,kernel,calls,ns_per_call,ns_per_cell,gb_per_s,calls_per_s,"
+	       "cycles_per_cell,ipc,cache_misses_per_cell\n";
+	
+	int count = 0;
+	for (Size grid : grids)
+		for (int t : threads)
+			count += Run(paths, track, grid, t > 0 ? t : CPU_Cores(), idle, out);
+	
+	Cerr() << count << " measurements, " << GetSplitStepKernelName(GetSplitStepKernel()) << " kernel\n";
+}